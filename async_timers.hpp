@@ -24,131 +24,4640 @@
 // SOFTWARE.
 
 #include <mutex>
+#include <array>
+#include <algorithm>
+#include <bit>
 #include <chrono>
 #include <atomic>
+#include <memory>
 #include <thread>
+#include <vector>
 #include <future>
+#include <limits>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
 #include <iostream>
 #include <functional>
+#include <utility>
 #include <type_traits>
 #include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <span>
+
+#include <system_error>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SIZEOF_INT128__) && (defined(__GNUC__) || defined(__clang__))
+#define ASYNC_TIMERS_HAS_TSC 1
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define ASYNC_TIMERS_HAS_IO_URING 1
+#include <linux/io_uring.h>
+#endif
 
 namespace async_timers
 {
-static constexpr auto DEBUG_MODE {true};
-class instance
+enum class trace_event
+{
+    restart_requested,
+    restarting,
+    thread_started,
+    stopped_prematurely,
+    single_shot_finished,
+    clock_started
+};
+
+// Tracing policies for basic_instance. A policy provides a static
+// on(trace_event) that is called from the timer hot path; no_trace
+// compiles away entirely.
+struct no_trace
+{
+    static constexpr void on(trace_event) noexcept {}
+};
+
+struct cout_trace
+{
+    static void on(trace_event event)
+    {
+        switch (event)
+        {
+        case trace_event::restart_requested:
+            std::cout << "timer is already running, will stop and restart.\n";
+            break;
+        case trace_event::restarting:
+            std::cout << "about to (re)start timer.\n";
+            break;
+        case trace_event::thread_started:
+            std::cout << "thread id this timer runs on= " << std::this_thread::get_id() << "\n";
+            break;
+        case trace_event::stopped_prematurely:
+            std::cout << "async_timer was stopped prematurely.\n";
+            break;
+        case trace_event::single_shot_finished:
+            std::cout << "stop timer due to activated single shot property.\n";
+            break;
+        case trace_event::clock_started:
+            std::cout << "start clock that counts down to 0.\n";
+            break;
+        }
+    }
+};
+
+// What a periodic timer does with ticks it could not fire on time: skip
+// them and resume on the next future tick, burst through every missed
+// tick back to back, or coalesce them into a single immediate tick. Ticks
+// only count as missed once the next one due is a whole period late; until
+// then that one still fires, under every policy. After a longer stall skip
+// drops every tick already due, including one less than a period late.
+enum class catch_up
+{
+    skip,
+    burst,
+    coalesce
+};
+
+// Move-only type-erased callable that keeps targets of up to Capacity bytes
+// inline. Larger or throwing-move targets fall back to the heap.
+template <class Signature, std::size_t Capacity = 64>
+class inplace_function;
+
+template <class R, class... Args, std::size_t Capacity>
+class inplace_function<R(Args...), Capacity>
+{
+public:
+    inplace_function() noexcept = default;
+    inplace_function(std::nullptr_t) noexcept {}
+    template <class Function, class = std::enable_if_t<!std::is_same_v<std::decay_t<Function>, inplace_function> &&
+                                                        std::is_invocable_r_v<R, std::decay_t<Function>&, Args...>>>
+    inplace_function(Function&& f)
+    {
+        using target = std::decay_t<Function>;
+        if constexpr (stored_inline<target>)
+        {
+            ::new (static_cast<void*>(storage)) target(std::forward<Function>(f));
+            ops = &inline_ops<target>;
+        }
+        else
+        {
+            ::new (static_cast<void*>(storage)) target*(new target(std::forward<Function>(f)));
+            ops = &heap_ops<target>;
+        }
+    }
+    inplace_function(const inplace_function&) = delete;
+    inplace_function(inplace_function&& other) noexcept
+    {
+        take(other);
+    }
+    inplace_function& operator=(const inplace_function&) = delete;
+    inplace_function& operator=(inplace_function&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            take(other);
+        }
+        return *this;
+    }
+    inplace_function& operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+    ~inplace_function()
+    {
+        reset();
+    }
+    explicit operator bool() const noexcept
+    {
+        return ops != nullptr;
+    }
+    R operator()(Args... args)
+    {
+        return ops->invoke(storage, std::forward<Args>(args)...);
+    }
+private:
+    struct vtable
+    {
+        R (*invoke)(void*, Args&&...);
+        void (*move)(void* from, void* to) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+
+    template <class T>
+    static constexpr bool stored_inline = sizeof(T) <= Capacity && alignof(T) <= alignof(std::max_align_t) &&
+                                          std::is_nothrow_move_constructible_v<T>;
+
+    template <class T>
+    static R call(T& target, Args&&... args)
+    {
+        if constexpr (std::is_void_v<R>)
+        {
+            std::invoke(target, std::forward<Args>(args)...);
+        }
+        else
+        {
+            return std::invoke(target, std::forward<Args>(args)...);
+        }
+    }
+
+    template <class T>
+    static constexpr vtable inline_ops
+    {
+        [](void* p, Args&&... args) -> R
+        {
+            return call(*static_cast<T*>(p), std::forward<Args>(args)...);
+        },
+        [](void* from, void* to) noexcept
+        {
+            ::new (to) T(std::move(*static_cast<T*>(from)));
+            static_cast<T*>(from)->~T();
+        },
+        [](void* p) noexcept
+        {
+            static_cast<T*>(p)->~T();
+        }
+    };
+
+    template <class T>
+    static constexpr vtable heap_ops
+    {
+        [](void* p, Args&&... args) -> R
+        {
+            return call(**static_cast<T**>(p), std::forward<Args>(args)...);
+        },
+        [](void* from, void* to) noexcept
+        {
+            ::new (to) T*(*static_cast<T**>(from));
+        },
+        [](void* p) noexcept
+        {
+            delete *static_cast<T**>(p);
+        }
+    };
+
+    void take(inplace_function& other) noexcept
+    {
+        if (other.ops != nullptr)
+        {
+            other.ops->move(other.storage, storage);
+            ops = std::exchange(other.ops, nullptr);
+        }
+    }
+    void reset() noexcept
+    {
+        if (ops != nullptr)
+        {
+            std::exchange(ops, nullptr)->destroy(storage);
+        }
+    }
+private:
+    alignas(std::max_align_t) unsigned char storage[Capacity < sizeof(void*) ? sizeof(void*) : Capacity];
+    const vtable* ops {nullptr};
+};
+
+namespace detail
+{
+enum class timer_event
+{
+    expired,
+    cancelled
+};
+
+// A rescheduling node is an armed one whose deadline is being moved;
+// scheduler::reschedule() leaves that phase within a few instructions.
+enum class timer_phase : std::uint64_t
+{
+    idle,
+    armed,
+    firing,
+    cancelled,
+    rescheduling
+};
+
+// Timer state packed into one word: the arm generation above three phase
+// bits. Every arm bumps the generation, so a CAS against a remembered word
+// fails once the timer was re-armed.
+constexpr std::uint64_t make_state(std::uint64_t generation, timer_phase phase) noexcept
+{
+    return generation << 3 | static_cast<std::uint64_t>(phase);
+}
+
+constexpr std::uint64_t generation_of(std::uint64_t state) noexcept
+{
+    return state >> 3;
+}
+
+constexpr timer_phase phase_of(std::uint64_t state) noexcept
+{
+    return static_cast<timer_phase>(state & 7);
+}
+
+// Spin-wait hint for the core, e.g. PAUSE on x86.
+inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield");
+#else
+    std::this_thread::yield();
+#endif
+}
+
+// A small number for the calling thread, handed out in order of first use,
+// to spread threads over striped structures.
+inline std::size_t thread_stripe() noexcept
+{
+    static std::atomic<std::size_t> next {0};
+    static thread_local const std::size_t stripe {next.fetch_add(1, std::memory_order_relaxed)};
+    return stripe;
+}
+
+// Periodic deadlines anchored on the first arm: tick k is due at
+// anchor + k * period, independent of callback run time and wakeup latency.
+struct cadence
+{
+    using clock = std::chrono::steady_clock;
+
+    cadence(clock::time_point start, clock::duration interval) noexcept
+        : anchor(start), period(std::max(interval, clock::duration(1))) {}
+
+    clock::time_point deadline() const noexcept
+    {
+        return anchor + period * index;
+    }
+    clock::time_point advance(clock::time_point now, catch_up policy) noexcept
+    {
+        ++index;
+        if (policy != catch_up::burst && deadline() + period <= now)
+        {
+            auto latest = static_cast<std::uint64_t>((now - anchor) / period);
+            index = policy == catch_up::skip ? latest + 1 : latest;
+        }
+        return deadline();
+    }
+
+    clock::time_point anchor;
+    clock::duration period;
+    std::uint64_t index {1};
+};
+
+class timer_list;
+
+// Intrusive wheel entry. The handler runs on a dispatcher thread; on
+// timer_event::expired it returns the next deadline to stay armed. Its
+// inline storage fits basic_instance's bookkeeping plus a 64 byte callable.
+static constexpr std::size_t handler_capacity {128};
+
+using timer_handler = inplace_function<std::optional<std::chrono::steady_clock::time_point>(timer_event), handler_capacity>;
+
+// Fields are ordered by size so the node packs without holes.
+struct timer_node
+{
+    std::atomic<std::uint64_t> state {0};
+    std::atomic<std::chrono::steady_clock::rep> deadline {0};
+    // What a snapshot records of a tagged timer besides its deadline.
+    std::atomic<std::uint64_t> id {0};
+    timer_node* next_queued {nullptr};
+    // Owned by the dispatcher: the generation the wheel entry was inserted
+    // for and the link of the dispatcher's transient lists, which a worker's
+    // inbox reuses once the node is handed off.
+    std::uint64_t generation {0};
+    timer_node* next {nullptr};
+    timer_handler handler;
+    // How many ticks late the node may fire so it shares a wakeup with others.
+    std::atomic<std::uint32_t> slack {0};
+    std::atomic<std::uint32_t> tag {untagged};
+    // One reference held by the owner until the node is released and its arm
+    // settled, one per arm queue entry; the last one returns it to the pool.
+    std::atomic<std::uint32_t> refs {0};
+    std::uint32_t index {0};
+    std::atomic<std::uint32_t> next_free {0};
+    // Where the wheel entry sits; owned by the dispatcher.
+    std::uint32_t wheel_slot {no_slot};
+    std::uint32_t wheel_position {0};
+    std::atomic_bool queued {false};
+    std::atomic_bool released {false};
+
+    static constexpr std::uint32_t no_slot {std::numeric_limits<std::uint32_t>::max()};
+    static constexpr std::uint32_t untagged {std::numeric_limits<std::uint32_t>::max()};
+};
+
+// Chase-Lev work-stealing deque of fixed capacity: the owning thread pushes
+// and pops at the bottom, any other thread steals from the top.
+template <class T, std::size_t Capacity = 1024>
+class steal_deque
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+public:
+    bool push(T* item) noexcept
+    {
+        auto b = bottom.load(std::memory_order_relaxed);
+        auto t = top.load(std::memory_order_acquire);
+        if (b - t >= static_cast<std::int64_t>(Capacity))
+        {
+            return false;
+        }
+        slots[b & mask].store(item, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+    T* pop() noexcept
+    {
+        auto b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_seq_cst);
+        auto t = top.load(std::memory_order_seq_cst);
+        if (t > b)
+        {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        auto item = slots[b & mask].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            {
+                item = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+    T* steal() noexcept
+    {
+        auto t = top.load(std::memory_order_seq_cst);
+        auto b = bottom.load(std::memory_order_seq_cst);
+        if (t >= b)
+        {
+            return nullptr;
+        }
+        auto item = slots[t & mask].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        {
+            return nullptr;
+        }
+        return item;
+    }
+private:
+    static constexpr std::int64_t mask {Capacity - 1};
+    alignas(64) std::atomic<std::int64_t> top {0};
+    alignas(64) std::atomic<std::int64_t> bottom {0};
+    std::array<std::atomic<T*>, Capacity> slots {};
+};
+
+// Per-thread free lists of small blocks, used for the shared state behind
+// the futures returned by start(). The last owner of a future usually sits
+// on another thread than the one re-arming, so full lists hand batches to a
+// shared depot and empty ones refill from it.
+class block_cache
+{
+public:
+    static constexpr std::size_t class_count {4};
+    static constexpr std::size_t smallest {64};
+    static constexpr std::size_t batch {32};
+
+    static void* allocate(std::size_t bytes)
+    {
+        auto index = class_of(bytes);
+        if (index == class_count)
+        {
+            return ::operator new(bytes);
+        }
+        auto& cache = local();
+        if (cache.heads[index] == nullptr && cache.alive)
+        {
+            refill(cache, index);
+        }
+        if (cache.heads[index] != nullptr)
+        {
+            auto block = cache.heads[index];
+            cache.heads[index] = block->next;
+            --cache.counts[index];
+            return block;
+        }
+        return ::operator new(smallest << index);
+    }
+    static void deallocate(void* p, std::size_t bytes) noexcept
+    {
+        auto index = class_of(bytes);
+        auto& cache = local();
+        if (index == class_count || !cache.alive)
+        {
+            ::operator delete(p);
+            return;
+        }
+        cache.heads[index] = ::new (p) block {cache.heads[index], nullptr};
+        if (++cache.counts[index] == 2 * batch)
+        {
+            spill(cache, index);
+        }
+    }
+private:
+    struct block
+    {
+        block* next;
+        block* next_batch;
+    };
+    struct lists
+    {
+        std::array<block*, class_count> heads;
+        std::array<std::size_t, class_count> counts;
+        bool alive;
+    };
+    struct depot
+    {
+        std::mutex mutex;
+        std::array<block*, class_count> batches {};
+    };
+    struct owner
+    {
+        owner() noexcept
+        {
+            state().alive = true;
+        }
+        ~owner()
+        {
+            auto& cache = state();
+            cache.alive = false;
+            for (auto& head : cache.heads)
+            {
+                while (head != nullptr)
+                {
+                    ::operator delete(std::exchange(head, head->next));
+                }
+            }
+        }
+    };
+
+    static std::size_t class_of(std::size_t bytes) noexcept
+    {
+        std::size_t index {0};
+        while (index < class_count && (smallest << index) < bytes)
+        {
+            ++index;
+        }
+        return index;
+    }
+    // Moves `batch` blocks from the thread list to the depot.
+    static void spill(lists& cache, std::size_t index) noexcept
+    {
+        auto first = cache.heads[index];
+        auto last = first;
+        for (std::size_t i = 1; i < batch; ++i)
+        {
+            last = last->next;
+        }
+        cache.heads[index] = last->next;
+        last->next = nullptr;
+        cache.counts[index] -= batch;
+        auto& shared = shared_depot();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        first->next_batch = shared.batches[index];
+        shared.batches[index] = first;
+    }
+    static void refill(lists& cache, std::size_t index) noexcept
+    {
+        auto& shared = shared_depot();
+        std::lock_guard<std::mutex> lock(shared.mutex);
+        if (auto first = shared.batches[index])
+        {
+            shared.batches[index] = first->next_batch;
+            cache.heads[index] = first;
+            cache.counts[index] = batch;
+        }
+    }
+    // Never destroyed: blocks may be freed during static destruction.
+    static depot& shared_depot() noexcept
+    {
+        static auto shared = new depot;
+        return *shared;
+    }
+    static lists& state() noexcept
+    {
+        thread_local lists cache {};
+        return cache;
+    }
+    static lists& local() noexcept
+    {
+        thread_local owner guard;
+        (void)guard;
+        return state();
+    }
+};
+
+template <class T>
+struct recycling_allocator
+{
+    using value_type = T;
+
+    recycling_allocator() noexcept = default;
+    template <class U>
+    recycling_allocator(const recycling_allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n)
+    {
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+        }
+        else
+        {
+            return static_cast<T*>(block_cache::allocate(n * sizeof(T)));
+        }
+    }
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        if constexpr (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+        {
+            ::operator delete(p, std::align_val_t(alignof(T)));
+        }
+        else
+        {
+            block_cache::deallocate(p, n * sizeof(T));
+        }
+    }
+    friend bool operator==(const recycling_allocator&, const recycling_allocator&) noexcept
+    {
+        return true;
+    }
+};
+
+// Fixed-address node storage. Chunks are never freed before the pool, so a
+// node number can be resolved without locking; the free list head packs a
+// tag next to the node number to defeat ABA.
+class node_pool
+{
+public:
+    static constexpr unsigned chunk_bits {8};
+    static constexpr std::size_t chunk_size {std::size_t{1} << chunk_bits};
+    static constexpr std::size_t max_chunks {std::size_t{1} << 16};
+
+    node_pool() : chunks(new timer_node*[max_chunks]) {}
+    node_pool(const node_pool&) = delete;
+    node_pool& operator=(const node_pool&) = delete;
+    ~node_pool()
+    {
+        for (std::size_t i = 0; i < chunk_count; ++i)
+        {
+            delete[] chunks[i];
+        }
+    }
+
+    timer_node& acquire()
+    {
+        for (;;)
+        {
+            auto head = free_head.load(std::memory_order_acquire);
+            while (index_of(head) != 0)
+            {
+                auto& node = at(index_of(head) - 1);
+                auto next = node.next_free.load(std::memory_order_relaxed);
+                if (free_head.compare_exchange_weak(head, pack(tag_of(head) + 1, next), std::memory_order_acquire))
+                {
+                    acquired.fetch_add(1, std::memory_order_relaxed);
+                    node.refs.store(1, std::memory_order_relaxed);
+                    return node;
+                }
+            }
+            std::lock_guard<std::mutex> lock(grow_mutex);
+            if (index_of(free_head.load()) != 0)
+            {
+                continue;
+            }
+            auto chunk = grow();
+            push(chunk[1], chunk[chunk_size - 1]);
+            acquired.fetch_add(1, std::memory_order_relaxed);
+            chunk[0].refs.store(1, std::memory_order_relaxed);
+            return chunk[0];
+        }
+    }
+    // Grows the pool to at least `count` nodes in total up front, so the
+    // chunks are allocated (and first touched) by the calling thread. Pass
+    // in_use() plus the nodes about to be acquired.
+    void reserve(std::size_t count)
+    {
+        std::lock_guard<std::mutex> lock(grow_mutex);
+        while (chunk_count * chunk_size < count)
+        {
+            auto chunk = grow();
+            push(chunk[0], chunk[chunk_size - 1]);
+        }
+    }
+    void release(timer_node& node) noexcept
+    {
+        node.released.store(false, std::memory_order_relaxed);
+        push(node, node);
+        acquired.fetch_sub(1, std::memory_order_relaxed);
+    }
+    // Nodes acquired and not yet released; exact only while nobody else
+    // acquires or releases.
+    std::size_t in_use() const noexcept
+    {
+        return acquired.load(std::memory_order_relaxed);
+    }
+    timer_node& at(std::uint32_t index) const noexcept
+    {
+        return chunks[index >> chunk_bits][index & (chunk_size - 1)];
+    }
+    // Visits every node allocated so far, in use or not.
+    template <class Visitor>
+    void for_each(Visitor&& visit) const
+    {
+        std::size_t count {0};
+        {
+            std::lock_guard<std::mutex> lock(grow_mutex);
+            count = chunk_count;
+        }
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            for (std::size_t j = 0; j < chunk_size; ++j)
+            {
+                visit(static_cast<const timer_node&>(chunks[i][j]));
+            }
+        }
+    }
+private:
+    static constexpr std::uint64_t pack(std::uint64_t tag, std::uint32_t index) noexcept
+    {
+        return tag << 32 | index;
+    }
+    static constexpr std::uint32_t index_of(std::uint64_t head) noexcept
+    {
+        return static_cast<std::uint32_t>(head);
+    }
+    static constexpr std::uint64_t tag_of(std::uint64_t head) noexcept
+    {
+        return head >> 32;
+    }
+    // Adds a chunk linked through next_free; requires grow_mutex.
+    timer_node* grow()
+    {
+        if (chunk_count == max_chunks)
+        {
+            throw std::bad_alloc();
+        }
+        auto chunk = new timer_node[chunk_size];
+        auto first = static_cast<std::uint32_t>(chunk_count << chunk_bits);
+        for (std::uint32_t i = 0; i < chunk_size; ++i)
+        {
+            chunk[i].index = first + i;
+            chunk[i].next_free.store(i + 1 < chunk_size ? first + i + 2 : 0, std::memory_order_relaxed);
+        }
+        chunks[chunk_count++] = chunk;
+        return chunk;
+    }
+    // Pushes the chain first..last, already linked through next_free.
+    void push(timer_node& first, timer_node& last) noexcept
+    {
+        auto head = free_head.load(std::memory_order_relaxed);
+        do
+        {
+            last.next_free.store(index_of(head), std::memory_order_relaxed);
+        }
+        while (!free_head.compare_exchange_weak(head, pack(tag_of(head) + 1, first.index + 1), std::memory_order_release));
+    }
+private:
+    std::unique_ptr<timer_node*[]> chunks;
+    std::size_t chunk_count {0};
+    std::atomic<std::uint64_t> free_head {0};
+    std::atomic<std::size_t> acquired {0};
+    mutable std::mutex grow_mutex;
+};
+
+// Singly linked FIFO of nodes the dispatcher is moving between the wheel,
+// the expired batch and the workers.
+class timer_list
+{
+public:
+    bool empty() const noexcept
+    {
+        return head == nullptr;
+    }
+    void push_back(timer_node& node) noexcept
+    {
+        node.next = nullptr;
+        (tail != nullptr ? tail->next : head) = &node;
+        tail = &node;
+    }
+    template <class Function>
+    void for_each(Function&& f)
+    {
+        for (auto node = head; node != nullptr; node = node->next)
+        {
+            f(*node);
+        }
+    }
+    timer_node* pop_front() noexcept
+    {
+        auto node = head;
+        if (node != nullptr)
+        {
+            head = node->next;
+            if (head == nullptr)
+            {
+                tail = nullptr;
+            }
+            node->next = nullptr;
+        }
+        return node;
+    }
+private:
+    timer_node* head {nullptr};
+    timer_node* tail {nullptr};
+};
+
+// Slot index bits per wheel level, finest first.
+inline constexpr std::array<unsigned, 4> wheel_level_bits {8, 6, 6, 6};
+
+// Bit position of a level's slot index within a tick.
+constexpr unsigned wheel_shift(unsigned level) noexcept
+{
+    unsigned bits {0};
+    for (unsigned below = 0; below < level; ++below)
+    {
+        bits += wheel_level_bits[below];
+    }
+    return bits;
+}
+
+// Position of a level's first slot in the flat slot array.
+constexpr std::size_t wheel_offset(unsigned level) noexcept
+{
+    std::size_t first {0};
+    for (unsigned below = 0; below < level; ++below)
+    {
+        first += std::size_t{1} << wheel_level_bits[below];
+    }
+    return first;
+}
+
+// Hierarchical timing wheel in the classic cascading layout: level 0 holds
+// the next 256 ticks, every further level covers 64 times the span of the one
+// below it. Cascading is lazy: a timer only moves down once the coarse slot
+// it sits in comes due, so one cancelled earlier is never touched again.
+// Timers beyond the 2^26 tick horizon (18.6 h at 1 ms) wait in an overflow
+// slot that is re-sorted whenever the top level wraps. Insert and erase are
+// O(1).
+//
+// A slot keeps its entries as two contiguous arrays, expiry ticks and pool
+// indices, so cascades scan packed 64-bit ticks instead of chasing nodes.
+// Erase swaps the last entry into the hole; each node remembers its slot
+// and position for that.
+//
+// A bitmap of occupied slots lets next_expiry() find the next tick with
+// anything to expire or cascade without walking the ticks in between, so
+// the wheel jumps straight from one such tick to the next.
+//
+// Timers inserted for a tick already passed, such as a periodic timer
+// catching up, go to an overdue slot that the next advance() expires
+// first, rather than waiting for the next tick.
+class timer_wheel
+{
+public:
+    static constexpr unsigned level_count {wheel_level_bits.size()};
+
+    // Slots start with a little capacity so a wheel that keeps turning does
+    // not allocate as ticks reach slots for the first time.
+    static constexpr std::size_t reserved_entries {4};
+
+    explicit timer_wheel(const node_pool& storage, std::uint64_t first_tick = 0) : pool(storage), current(first_tick)
+    {
+        for (auto& entries : slots)
+        {
+            entries.expires.reserve(reserved_entries);
+            entries.nodes.reserve(reserved_entries);
+        }
+    }
+
+    bool empty() const noexcept
+    {
+        return size == 0;
+    }
+    std::size_t entries() const noexcept
+    {
+        return size;
+    }
+    // Entries moved by cascades so far.
+    std::uint64_t cascaded() const noexcept
+    {
+        return moved;
+    }
+    // The earliest tick at or after the current one where a slot comes due:
+    // a level 0 slot that expires, or the start of the span of an occupied
+    // upper slot that cascades. Overdue timers make it the tick before the
+    // current one. Requires a non-empty wheel.
+    std::uint64_t next_expiry() const noexcept
+    {
+        if (!slots[overdue_slot].nodes.empty())
+        {
+            return current - 1;
+        }
+        auto earliest = std::numeric_limits<std::uint64_t>::max();
+        auto ahead = distance_to_occupied(0, index_at(0, current));
+        if (ahead < level_size(0))
+        {
+            earliest = current + ahead;
+        }
+        for (unsigned level = 1; level < level_count; ++level)
+        {
+            // The current span's own slot only cascades if its first tick is
+            // still to be processed; otherwise it is a full turn away.
+            auto started = (current & ((std::uint64_t{1} << wheel_shift(level)) - 1)) != 0 ? 1 : 0;
+            auto spans = distance_to_occupied(level, index_at(level, current) + started) + started;
+            if (spans <= level_size(level))
+            {
+                auto span = (current >> wheel_shift(level)) + spans;
+                earliest = std::min(earliest, span << wheel_shift(level));
+            }
+        }
+        if (!slots[overflow_slot].nodes.empty())
+        {
+            auto started = (current & ((std::uint64_t{1} << wheel_shift(level_count)) - 1)) != 0 ? 1 : 0;
+            earliest = std::min(earliest, ((current >> wheel_shift(level_count)) + started) << wheel_shift(level_count));
+        }
+        return earliest;
+    }
+    bool contains(const timer_node& node) const noexcept
+    {
+        return node.wheel_slot != timer_node::no_slot;
+    }
+    void insert(timer_node& node, std::uint64_t expires)
+    {
+        place(node, slot_for(expires), expires);
+        ++size;
+    }
+    void erase(timer_node& node) noexcept
+    {
+        remove(node);
+        --size;
+    }
+    // Moves every timer due at or before `tick` into `expired`.
+    void advance(std::uint64_t tick, timer_list& expired)
+    {
+        expire(overdue_slot, expired);
+        while (size != 0)
+        {
+            auto next = next_expiry();
+            if (next > tick)
+            {
+                break;
+            }
+            current = next;
+            auto index = index_at(0, current);
+            unsigned level = 1;
+            for (; index == 0 && level < level_count; ++level)
+            {
+                index = index_at(level, current);
+                cascade(static_cast<std::uint32_t>(wheel_offset(level) + index));
+            }
+            if (index == 0 && level == level_count)
+            {
+                cascade(overflow_slot);
+            }
+            expire(static_cast<std::uint32_t>(index_at(0, current)), expired);
+            ++current;
+        }
+        fast_forward(tick + 1);
+    }
+    // Skips the ticks before `tick` if none of them has anything to expire
+    // or cascade, so later inserts are placed relative to the present.
+    void fast_forward(std::uint64_t tick) noexcept
+    {
+        if (current < tick && (size == 0 || next_expiry() >= tick))
+        {
+            current = tick;
+        }
+    }
+    void clear(timer_list& removed) noexcept
+    {
+        for (auto& entries : slots)
+        {
+            for (auto node : entries.nodes)
+            {
+                auto& cleared = pool.at(node);
+                cleared.wheel_slot = timer_node::no_slot;
+                removed.push_back(cleared);
+            }
+            entries.clear();
+        }
+        occupied.fill(0);
+        size = 0;
+    }
+private:
+    struct slot
+    {
+        std::vector<std::uint64_t> expires;
+        std::vector<std::uint32_t> nodes;
+
+        void clear() noexcept
+        {
+            expires.clear();
+            nodes.clear();
+        }
+    };
+
+    static constexpr std::uint32_t overflow_slot {static_cast<std::uint32_t>(wheel_offset(level_count))};
+    static constexpr std::uint32_t overdue_slot {overflow_slot + 1};
+
+    static constexpr std::uint64_t index_at(unsigned level, std::uint64_t tick) noexcept
+    {
+        return (tick >> wheel_shift(level)) & ((std::uint64_t{1} << wheel_level_bits[level]) - 1);
+    }
+    static constexpr std::uint64_t level_size(unsigned level) noexcept
+    {
+        return std::uint64_t{1} << wheel_level_bits[level];
+    }
+    void mark(std::uint32_t index) noexcept
+    {
+        occupied[index >> 6] |= std::uint64_t{1} << (index & 63);
+    }
+    void unmark(std::uint32_t index) noexcept
+    {
+        occupied[index >> 6] &= ~(std::uint64_t{1} << (index & 63));
+    }
+    // Slots from `from` (wrapping) to the first occupied one of `level`, or
+    // the level size if all are empty.
+    std::uint64_t distance_to_occupied(unsigned level, std::uint64_t from) const noexcept
+    {
+        const auto slots_in_level = level_size(level);
+        const auto base = wheel_offset(level);
+        std::uint64_t distance {0};
+        while (distance < slots_in_level)
+        {
+            auto position = (from + distance) & (slots_in_level - 1);
+            auto bit = (base + position) & 63;
+            auto span = std::min<std::uint64_t>(64 - bit, slots_in_level - position);
+            auto word = occupied[(base + position) >> 6] >> bit;
+            if (span < 64)
+            {
+                word &= (std::uint64_t{1} << span) - 1;
+            }
+            if (word != 0)
+            {
+                return distance + static_cast<std::uint64_t>(std::countr_zero(word));
+            }
+            distance += span;
+        }
+        return slots_in_level;
+    }
+    std::uint32_t slot_for(std::uint64_t expires) const noexcept
+    {
+        if (expires < current)
+        {
+            return overdue_slot;
+        }
+        auto delta = expires - current;
+        for (unsigned level = 0; level < level_count; ++level)
+        {
+            if (delta < (std::uint64_t{1} << wheel_shift(level + 1)))
+            {
+                return static_cast<std::uint32_t>(wheel_offset(level) + index_at(level, expires));
+            }
+        }
+        return overflow_slot;
+    }
+    void place(timer_node& node, std::uint32_t index, std::uint64_t expires)
+    {
+        auto& target = slots[index];
+        target.expires.push_back(expires);
+        target.nodes.push_back(node.index);
+        mark(index);
+        node.wheel_slot = index;
+        node.wheel_position = static_cast<std::uint32_t>(target.nodes.size() - 1);
+    }
+    void remove(timer_node& node) noexcept
+    {
+        auto& source = slots[node.wheel_slot];
+        auto position = node.wheel_position;
+        if (position + 1 != source.nodes.size())
+        {
+            source.expires[position] = source.expires.back();
+            source.nodes[position] = source.nodes.back();
+            pool.at(source.nodes[position]).wheel_position = position;
+        }
+        source.expires.pop_back();
+        source.nodes.pop_back();
+        if (source.nodes.empty())
+        {
+            unmark(node.wheel_slot);
+        }
+        node.wheel_slot = timer_node::no_slot;
+    }
+    void expire(std::uint32_t index, timer_list& expired) noexcept
+    {
+        auto& due = slots[index];
+        for (auto node : due.nodes)
+        {
+            auto& expiring = pool.at(node);
+            expiring.wheel_slot = timer_node::no_slot;
+            expired.push_back(expiring);
+        }
+        size -= due.nodes.size();
+        due.clear();
+        unmark(index);
+    }
+    // Re-sorts one slot of an upper level; the emptied arrays are swapped
+    // into `spare` so neither side gives up its capacity.
+    void cascade(std::uint32_t index)
+    {
+        std::swap(spare, slots[index]);
+        unmark(index);
+        for (std::size_t i = 0; i < spare.nodes.size(); ++i)
+        {
+            place(pool.at(spare.nodes[i]), slot_for(spare.expires[i]), spare.expires[i]);
+        }
+        moved += spare.nodes.size();
+        spare.clear();
+    }
+private:
+    const node_pool& pool;
+    std::array<slot, overdue_slot + 1> slots {};
+    std::array<std::uint64_t, (overdue_slot + 64) / 64> occupied {};
+    slot spare;
+    std::uint64_t current;
+    std::size_t size {0};
+    std::uint64_t moved {0};
+};
+
+// Timers keep one decay-copy of the callable and of each argument and call
+// them as lvalues on every round, so nothing is moved out by the first one.
+template <class Function, class... Args>
+using callback_result_t = std::invoke_result_t<std::decay_t<Function>&, std::decay_t<Args>&...>;
+
+template <class Result>
+struct pending_result
+{
+    std::promise<Result> promise {std::allocator_arg, recycling_allocator<Result>()};
+    Result last {};
+    template <class Call>
+    void store(Call&& call)
+    {
+        last = call();
+    }
+    void fail(std::exception_ptr error)
+    {
+        promise.set_exception(std::move(error));
+    }
+    void finish()
+    {
+        promise.set_value(std::move(last));
+    }
+};
+
+template <>
+struct pending_result<void>
+{
+    std::promise<void> promise {std::allocator_arg, recycling_allocator<void>()};
+    template <class Call>
+    void store(Call&& call)
+    {
+        call();
+    }
+    void fail(std::exception_ptr error)
+    {
+        promise.set_exception(std::move(error));
+    }
+    void finish()
+    {
+        promise.set_value();
+    }
+};
+
+// Result sink of start_detached(): nothing is kept, and an exception
+// escapes to the dispatcher like it would from a std::thread.
+struct discarded_result
+{
+    template <class Call>
+    void store(Call&& call)
+    {
+        call();
+    }
+    [[noreturn]] void fail(std::exception_ptr error)
+    {
+        std::rethrow_exception(std::move(error));
+    }
+    void finish() noexcept {}
+};
+
+// Result sink of start_streaming(): every result is moved into the sink as
+// soon as the callback returns it.
+template <class Sink>
+struct streamed_result
+{
+    Sink sink;
+    template <class Call>
+    void store(Call&& call)
+    {
+        std::invoke(sink, call());
+    }
+    [[noreturn]] void fail(std::exception_ptr error)
+    {
+        std::rethrow_exception(std::move(error));
+    }
+    void finish() noexcept {}
+};
+
+// Result of a legacy start(): std::async's future takes what finish()
+// returns.
+template <class Result>
+struct returned_result
+{
+    Result last {};
+    template <class Call>
+    void store(Call&& call)
+    {
+        last = call();
+    }
+    Result finish()
+    {
+        return std::move(last);
+    }
+};
+
+template <>
+struct returned_result<void>
+{
+    template <class Call>
+    void store(Call&& call)
+    {
+        call();
+    }
+    void finish() noexcept {}
+};
+}
+
+// Clock read off the invariant TSC and scaled to nanoseconds with a factor
+// calibrated against steady_clock on first use (a 10 ms measurement). Its
+// time points are steady_clock's, so both can be mixed freely: about once a
+// second a reader re-anchors the scale so that the remaining offset is
+// slewed away over the next second instead of accumulating, without ever
+// stepping backwards. Without an invariant TSC it forwards to steady_clock.
+class tsc_clock
+{
+public:
+    using duration = std::chrono::steady_clock::duration;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::steady_clock::time_point;
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept
+    {
+#if defined(ASYNC_TIMERS_HAS_TSC)
+        auto& shared = calibration();
+        while (shared.usable)
+        {
+            auto version = shared.version.load(std::memory_order_acquire);
+            auto base_cycles = shared.base_cycles.load(std::memory_order_acquire);
+            auto base_ns = shared.base_ns.load(std::memory_order_acquire);
+            auto scale = shared.scale.load(std::memory_order_acquire);
+            if ((version & 1) != 0 || shared.version.load(std::memory_order_relaxed) != version)
+            {
+                continue;
+            }
+            auto cycles = __rdtsc();
+            auto elapsed = cycles > base_cycles ? cycles - base_cycles : 0;
+            auto ns = base_ns + static_cast<std::int64_t>((static_cast<unsigned __int128>(elapsed) * scale) >> fraction_bits);
+            if (elapsed > shared.resync_cycles)
+            {
+                resync(shared, version, cycles, ns, scale);
+            }
+            return time_point(std::chrono::duration_cast<duration>(std::chrono::nanoseconds(ns)));
+        }
+#endif
+        return std::chrono::steady_clock::now();
+    }
+    static bool available() noexcept
+    {
+        return calibration().usable;
+    }
+private:
+    static constexpr unsigned fraction_bits {32};
+
+    // Seqlock-protected conversion: time = base_ns + (cycles - base_cycles)
+    // * scale, with scale in nanoseconds per cycle as fixed point.
+    struct factors
+    {
+        bool usable {false};
+        std::uint64_t resync_cycles {0};
+        std::atomic<std::uint64_t> version {0};
+        std::atomic<std::uint64_t> base_cycles {0};
+        std::atomic<std::int64_t> base_ns {0};
+        std::atomic<std::uint64_t> scale {0};
+    };
+
+    static factors& calibration() noexcept
+    {
+        static factors shared;
+        static const bool calibrated = calibrate(shared);
+        (void)calibrated;
+        return shared;
+    }
+    static bool calibrate([[maybe_unused]] factors& shared) noexcept
+    {
+#if defined(ASYNC_TIMERS_HAS_TSC)
+        unsigned eax, ebx, ecx, edx;
+        if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 || (edx & (1u << 8)) == 0)
+        {
+            return false;
+        }
+        auto start_time = std::chrono::steady_clock::now();
+        auto start_cycles = __rdtsc();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        auto end_time = std::chrono::steady_clock::now();
+        auto end_cycles = __rdtsc();
+        if (end_cycles <= start_cycles)
+        {
+            return false;
+        }
+        auto elapsed = static_cast<unsigned __int128>(std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count());
+        auto scale = static_cast<std::uint64_t>((elapsed << fraction_bits) / (end_cycles - start_cycles));
+        shared.base_cycles.store(end_cycles, std::memory_order_relaxed);
+        shared.base_ns.store(std::chrono::duration_cast<std::chrono::nanoseconds>(end_time.time_since_epoch()).count(), std::memory_order_relaxed);
+        shared.scale.store(scale, std::memory_order_relaxed);
+        shared.resync_cycles = static_cast<std::uint64_t>((static_cast<unsigned __int128>(1000000000) << fraction_bits) / scale);
+        shared.usable = true;
+        return true;
+#else
+        return false;
+#endif
+    }
+#if defined(ASYNC_TIMERS_HAS_TSC)
+    // Re-anchors at (cycles, ns), keeping the clock continuous, with a scale
+    // that meets steady_clock one resync interval from now. Changes are
+    // capped at 0.1% so time keeps moving forward.
+    static void resync(factors& shared, std::uint64_t version, std::uint64_t cycles, std::int64_t ns, std::uint64_t scale) noexcept
+    {
+        if (!shared.version.compare_exchange_strong(version, version + 1, std::memory_order_acq_rel))
+        {
+            return;
+        }
+        auto steady_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto interval_ns = static_cast<std::int64_t>((static_cast<unsigned __int128>(shared.resync_cycles) * scale) >> fraction_bits);
+        auto target = std::max<std::int64_t>(steady_ns + interval_ns - ns, 1);
+        auto slewed = static_cast<std::uint64_t>((static_cast<unsigned __int128>(target) << fraction_bits) / shared.resync_cycles);
+        slewed = std::clamp(slewed, scale - scale / 1000, scale + scale / 1000);
+        shared.base_cycles.store(cycles, std::memory_order_release);
+        shared.base_ns.store(ns, std::memory_order_release);
+        shared.scale.store(slewed, std::memory_order_release);
+        shared.version.store(version + 2, std::memory_order_release);
+    }
+#endif
+};
+
+// Where the scheduler reads the time for arms and expiry.
+enum class clock_source
+{
+    steady,
+    // tsc_clock; falls back to steady where it is not available.
+    tsc
+};
+
+// How dispatchers sleep until the next tick is due.
+enum class wait_backend
+{
+    condition_variable,
+    // Linux only: a CLOCK_MONOTONIC timerfd with absolute deadlines plus an
+    // eventfd for arms, both behind one epoll descriptor.
+    timerfd,
+    // No dispatcher threads: the owner's event loop waits for
+    // next_deadline() itself, calls advance() and hears through
+    // set_wakeup() when an arm needs an earlier deadline.
+    external
+};
+
+// How a dispatcher waits for the next due tick. Spinning trades a core for
+// firing without the OS wakeup latency; pair it with dispatcher_cpus.
+enum class wait_strategy
+{
+    block,
+    // Blocks until spin_threshold before the tick, then spins.
+    spin_then_block,
+    // Never blocks, not even with nothing armed.
+    busy_poll
+};
+
+struct scheduler_options
+{
+    std::size_t dispatchers {1};
+    std::chrono::steady_clock::duration tick {std::chrono::milliseconds(1)};
+    // Threads that run expired callbacks; with none, callbacks run on the
+    // dispatcher that detected the expiry.
+    std::size_t workers {0};
+    // CPUs the workers are pinned to, assigned round-robin. Only honoured on
+    // Linux; empty leaves the workers unpinned.
+    std::vector<int> worker_cpus {};
+    // How late a timer without its own slack may fire. Deadlines are rounded
+    // up to a multiple of the slack, so timers due close together expire in
+    // the same tick and are dispatched as one batch.
+    std::chrono::steady_clock::duration slack {std::chrono::steady_clock::duration::zero()};
+    wait_backend backend {wait_backend::condition_variable};
+    wait_strategy strategy {wait_strategy::block};
+    std::chrono::steady_clock::duration spin_threshold {std::chrono::microseconds(100)};
+    // CPUs the dispatchers are pinned to, like worker_cpus.
+    std::vector<int> dispatcher_cpus {};
+    clock_source time_source {clock_source::steady};
+    // Lock-free stacks that arming threads push onto, one cache line each, so
+    // producers do not contend while their number stays below it. 0 picks
+    // one per hardware thread, up to 64.
+    std::size_t arm_queues {0};
+    // Timer nodes allocated by the constructor rather than on first use.
+    std::size_t reserve_timers {0};
+};
+
+class scheduler;
+
+// Refers to one arm of a timer posted with scheduler::post_after. Cheap to
+// copy; operations on a handle whose timer already fired or was cancelled
+// are no-ops, even after the node was reused for another timer.
+class timer_handle
+{
+public:
+    timer_handle() noexcept = default;
+
+    // Returns true if the callback had not started yet and now never will.
+    bool cancel() noexcept;
+    // Moves a pending expiry to `deadline`; for a periodic timer only the
+    // next one. Returns false once the callback started or the arm is gone.
+    // Copies of the handle taken before a successful reschedule go stale.
+    bool reschedule(std::chrono::steady_clock::time_point deadline) noexcept;
+    template <class Rep, class Period>
+    bool reschedule(std::chrono::duration<Rep, Period> delay) noexcept
+    {
+        return reschedule_after(std::chrono::ceil<std::chrono::steady_clock::duration>(delay));
+    }
+    explicit operator bool() const noexcept
+    {
+        return node != nullptr;
+    }
+private:
+    friend class scheduler;
+    template <class Trace, class Clock>
+    friend class basic_instance;
+
+    timer_handle(scheduler& owner, detail::timer_node& timer, std::uint64_t arm) noexcept
+        : sched(&owner), node(&timer), generation(arm) {}
+
+    bool reschedule_after(std::chrono::steady_clock::duration delay) noexcept;
+
+    scheduler* sched {nullptr};
+    detail::timer_node* node {nullptr};
+    std::uint64_t generation {0};
+};
+
+// One timer of a scheduler::arm_bulk batch.
+struct timer_spec
+{
+    std::chrono::steady_clock::time_point deadline;
+    inplace_function<void()> callback;
+    std::optional<std::chrono::steady_clock::duration> slack {};
+};
+
+// Callbacks of tagged timers by tag, which together with the timer's id is
+// all a snapshot keeps of it, so that a restored timer finds its callback
+// again. Bind every tag before arming or restoring timers with it; the
+// registry has to outlive them.
+class timer_registry
+{
+public:
+    using callback = inplace_function<void(std::uint64_t id)>;
+
+    void bind(std::uint32_t tag, callback f)
+    {
+        callbacks.insert_or_assign(tag, std::move(f));
+    }
+    // Throws std::out_of_range for a tag that was never bound.
+    callback& at(std::uint32_t tag)
+    {
+        return callbacks.at(tag);
+    }
+    callback* find(std::uint32_t tag) noexcept
+    {
+        auto bound = callbacks.find(tag);
+        return bound != callbacks.end() ? &bound->second : nullptr;
+    }
+private:
+    std::unordered_map<std::uint32_t, callback> callbacks;
+};
+
+// One tagged timer of a snapshot. The deadline is in system_clock
+// nanoseconds, since steady_clock starts over with the machine.
+struct timer_snapshot_entry
+{
+    std::int64_t deadline;
+    std::uint64_t id;
+    std::uint32_t tag;
+    std::uint32_t reserved {0};
+};
+
+// Log-linear histogram of nanosecond durations: eight buckets per power of
+// two, so a bucket's bounds are within 12.5% of every value in it. Values
+// from 2^36 ns (about 69 s) on share the last bucket.
+struct latency_histogram
+{
+    static constexpr unsigned sub_bits {3};
+    static constexpr unsigned max_bits {36};
+    static constexpr std::size_t bucket_count {(max_bits - sub_bits + 1) << sub_bits};
+
+    static constexpr std::size_t bucket_of(std::uint64_t ns) noexcept
+    {
+        if (ns < (std::uint64_t{1} << sub_bits))
+        {
+            return static_cast<std::size_t>(ns);
+        }
+        auto exponent = static_cast<unsigned>(std::bit_width(ns)) - 1;
+        if (exponent >= max_bits)
+        {
+            return bucket_count - 1;
+        }
+        auto mantissa = (ns >> (exponent - sub_bits)) & ((std::uint64_t{1} << sub_bits) - 1);
+        return static_cast<std::size_t>((exponent - sub_bits + 1) << sub_bits | mantissa);
+    }
+    // The smallest value counted in bucket `index`; a bucket ends where the
+    // next one begins.
+    static constexpr std::uint64_t lower_bound(std::size_t index) noexcept
+    {
+        if (index < (std::size_t{1} << sub_bits))
+        {
+            return index;
+        }
+        auto exponent = static_cast<unsigned>(index >> sub_bits) + sub_bits - 1;
+        auto mantissa = index & ((std::size_t{1} << sub_bits) - 1);
+        return (std::uint64_t{1} << sub_bits | mantissa) << (exponent - sub_bits);
+    }
+
+    std::uint64_t count() const noexcept
+    {
+        std::uint64_t total {0};
+        for (auto n : counts)
+        {
+            total += n;
+        }
+        return total;
+    }
+    // Upper bound of the bucket holding quantile `q`, zero when empty.
+    std::chrono::nanoseconds quantile(double q) const noexcept
+    {
+        auto rank = static_cast<std::uint64_t>(std::clamp(q, 0.0, 1.0) * static_cast<double>(count()));
+        std::uint64_t seen {0};
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            seen += counts[i];
+            if (counts[i] != 0 && seen > rank)
+            {
+                return std::chrono::nanoseconds(i + 1 < bucket_count ? lower_bound(i + 1) : std::uint64_t{1} << max_bits);
+            }
+        }
+        return std::chrono::nanoseconds(count() == 0 ? 0 : std::uint64_t{1} << max_bits);
+    }
+
+    latency_histogram& operator+=(const latency_histogram& other) noexcept
+    {
+        for (std::size_t i = 0; i < bucket_count; ++i)
+        {
+            counts[i] += other.counts[i];
+        }
+        return *this;
+    }
+
+    std::array<std::uint64_t, bucket_count> counts {};
+};
+
+// Point-in-time totals from scheduler::metrics(). Counters only grow; the
+// gauges are derived from them, so they may be off by in-flight timers.
+struct scheduler_metrics
+{
+    std::uint64_t arms {0};
+    // Expiries whose callback ran, counting every round of a periodic timer.
+    std::uint64_t fires {0};
+    // Arms stopped by a cancel before their callback or their next round.
+    std::uint64_t cancels {0};
+    std::uint64_t reschedules {0};
+    // Wheel entries moved down a level or out of the overflow slot.
+    std::uint64_t cascades {0};
+    // Timers armed and neither cancelled nor done firing.
+    std::uint64_t active {0};
+    // Expired timers waiting for a dispatcher or worker to run them.
+    std::uint64_t ready {0};
+    // Entries in the wheel, including stale ones of cancelled arms.
+    std::uint64_t wheel_entries {0};
+    // Callback start minus deadline.
+    latency_histogram lateness;
+    latency_histogram callback_time;
+
+    scheduler_metrics& operator+=(const scheduler_metrics& other) noexcept
+    {
+        arms += other.arms;
+        fires += other.fires;
+        cancels += other.cancels;
+        reschedules += other.reschedules;
+        cascades += other.cascades;
+        active += other.active;
+        ready += other.ready;
+        wheel_entries += other.wheel_entries;
+        lateness += other.lateness;
+        callback_time += other.callback_time;
+        return *this;
+    }
+};
+
+namespace detail
+{
+// Counters written by one dispatcher or worker, or by arming threads that
+// hash to it; relaxed increments on a line of its own.
+struct alignas(64) metrics_shard
+{
+    std::atomic<std::uint64_t> arms {0};
+    std::atomic<std::uint64_t> settled {0};
+    std::atomic<std::uint64_t> claimed {0};
+    std::atomic<std::uint64_t> fires {0};
+    std::atomic<std::uint64_t> cancels {0};
+    std::atomic<std::uint64_t> reschedules {0};
+    std::array<std::atomic<std::uint64_t>, latency_histogram::bucket_count> lateness {};
+    std::array<std::atomic<std::uint64_t>, latency_histogram::bucket_count> callback_time {};
+
+    static void count(std::atomic<std::uint64_t>& counter, std::uint64_t n = 1) noexcept
+    {
+        counter.fetch_add(n, std::memory_order_relaxed);
+    }
+    static void record(std::array<std::atomic<std::uint64_t>, latency_histogram::bucket_count>& histogram,
+                       std::chrono::steady_clock::duration elapsed) noexcept
+    {
+        auto ns = std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), 0);
+        count(histogram[latency_histogram::bucket_of(static_cast<std::uint64_t>(ns))]);
+    }
+};
+
+// Leads a snapshot file, followed by `count` entries in deadline order. The
+// layout is fixed and native-endian so that a mapped file can be restored
+// from in place.
+struct snapshot_header
+{
+    static constexpr std::array<char, 8> expected_magic {'A', 'T', 'S', 'N', 'A', 'P', '\0', '\0'};
+    static constexpr std::uint32_t current_version {1};
+
+    std::array<char, 8> magic {expected_magic};
+    std::uint32_t version {current_version};
+    std::uint32_t entry_size {sizeof(timer_snapshot_entry)};
+    std::uint64_t count {0};
+
+    bool valid() const noexcept
+    {
+        return magic == expected_magic && version == current_version && entry_size == sizeof(timer_snapshot_entry);
+    }
+};
+
+// Flushes a file, or a directory's entries, to stable storage. Elsewhere
+// than Linux it does nothing.
+inline std::error_code sync_to_disk([[maybe_unused]] const std::filesystem::path& path, [[maybe_unused]] bool directory = false)
+{
+#if defined(__linux__)
+    auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | (directory ? O_DIRECTORY : 0));
+    if (fd < 0)
+    {
+        return std::error_code(errno, std::system_category());
+    }
+    std::error_code error;
+    if (::fsync(fd) != 0)
+    {
+        error = std::error_code(errno, std::system_category());
+    }
+    ::close(fd);
+    return error;
+#else
+    return {};
+#endif
+}
+}
+
+// Runs the timers of any number of instances on a fixed set of dispatcher
+// threads. Instances bound to a scheduler must not outlive it.
+//
+// Arming and cancelling never take the scheduler mutex: an arm moves the
+// node's state word to armed and pushes the node onto the lock-free arm
+// queue of its thread's stripe, a cancel is a single CAS that leaves the
+// stale wheel entry to be dropped when its slot comes up. The dispatcher
+// drains all queues into the wheel, which only it touches, before every
+// tick. The mutex is only taken to wake a dispatcher that sleeps past the
+// new deadline.
+class scheduler
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    explicit scheduler(std::size_t dispatcher_count = 1, clock::duration tick = std::chrono::milliseconds(1))
+        : scheduler(scheduler_options {dispatcher_count, tick}) {}
+    explicit scheduler(const scheduler_options& options)
+        : read_clock(options.time_source == clock_source::tsc && tsc_clock::available() ? &tsc_clock::now : &steady_now),
+          resolution(options.tick > clock::duration::zero() ? options.tick : clock::duration(1)), origin(now()),
+          default_slack(options.slack), backend(options.backend), strategy(options.strategy), spin_threshold(options.spin_threshold),
+          thread_shards(dispatcher_threads(options) + options.workers), shards(new detail::metrics_shard[thread_shards + external_shards]),
+          queue_count(arm_queue_count(options)), queues(new arm_queue[queue_count])
+    {
+        last_now.store(origin.time_since_epoch().count(), std::memory_order_relaxed);
+        nodes.reserve(options.reserve_timers);
+        if (backend == wait_backend::timerfd)
+        {
+            open_descriptors();
+            // Without dispatchers the owner polls native_handle() itself and
+            // has to hear about every arm until the first poll().
+            if (options.dispatchers == 0)
+            {
+                wake_tick.store(std::numeric_limits<std::uint64_t>::max());
+            }
+        }
+        else if (backend == wait_backend::external)
+        {
+            wake_tick.store(std::numeric_limits<std::uint64_t>::max());
+        }
+        workers.reserve(options.workers);
+        for (std::size_t i = 0; i < options.workers; ++i)
+        {
+            workers.push_back(std::make_unique<worker>());
+        }
+        for (std::size_t i = 0; i < options.workers; ++i)
+        {
+            workers[i]->thread = std::thread([this, i]
+            {
+                work(i);
+            });
+            if (!options.worker_cpus.empty())
+            {
+                pin(workers[i]->thread, options.worker_cpus[i % options.worker_cpus.size()]);
+            }
+        }
+        auto dispatcher_count = dispatcher_threads(options);
+        dispatchers.reserve(dispatcher_count);
+        for (std::size_t i = 0; i < dispatcher_count; ++i)
+        {
+            dispatchers.emplace_back([this, i]
+            {
+                run(i);
+            });
+            if (!options.dispatcher_cpus.empty())
+            {
+                pin(dispatchers.back(), options.dispatcher_cpus[i % options.dispatcher_cpus.size()]);
+            }
+        }
+    }
+    scheduler(const scheduler&) = delete;
+    scheduler(scheduler&&) = delete;
+    scheduler& operator=(const scheduler&) = delete;
+    scheduler& operator=(scheduler&&) = delete;
+    ~scheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake_all();
+        for (auto& dispatcher : dispatchers)
+        {
+            dispatcher.join();
+        }
+        workers_stopping.store(true);
+        for (auto& w : workers)
+        {
+            w->signal.fetch_add(1);
+            w->signal.notify_one();
+        }
+        for (auto& w : workers)
+        {
+            w->thread.join();
+        }
+        drain();
+        detail::timer_list remaining;
+        wheel.clear(remaining);
+        for (auto node = remaining.pop_front(); node != nullptr; node = remaining.pop_front())
+        {
+            auto expected = detail::make_state(node->generation, detail::timer_phase::armed);
+            if (node->state.compare_exchange_strong(expected, detail::make_state(node->generation, detail::timer_phase::cancelled)))
+            {
+                retire(*node, node->generation);
+            }
+        }
+        close_descriptors();
+    }
+    clock::duration tick() const noexcept
+    {
+        return resolution;
+    }
+    // Reads the configured clock source.
+    clock::time_point now() const noexcept
+    {
+        return read_clock();
+    }
+    // The time a dispatcher last read, without touching the clock, for arms
+    // that tolerate firing up to a tick early, or longer while a callback
+    // runs on the dispatcher. A dispatcher sleeping through
+    // idle ticks stops refreshing that reading, so while it sleeps, and on a
+    // poll()ed or external scheduler, this reads the clock like now().
+    clock::time_point coarse_now() const noexcept
+    {
+        if (wake_tick.load() != 0)
+        {
+            return now();
+        }
+        return clock::time_point(clock::duration(last_now.load(std::memory_order_relaxed)));
+    }
+    // Sums the per-thread counters without stopping anyone, so it is safe to
+    // scrape from any thread at any rate.
+    scheduler_metrics metrics() const noexcept
+    {
+        scheduler_metrics totals;
+        std::uint64_t settled {0};
+        std::uint64_t claimed {0};
+        for (std::size_t i = 0; i < thread_shards + external_shards; ++i)
+        {
+            auto& shard = shards[i];
+            settled += shard.settled.load(std::memory_order_relaxed);
+            claimed += shard.claimed.load(std::memory_order_relaxed);
+            totals.fires += shard.fires.load(std::memory_order_relaxed);
+            totals.cancels += shard.cancels.load(std::memory_order_relaxed);
+            totals.reschedules += shard.reschedules.load(std::memory_order_relaxed);
+            for (std::size_t bucket = 0; bucket < latency_histogram::bucket_count; ++bucket)
+            {
+                totals.lateness.counts[bucket] += shard.lateness[bucket].load(std::memory_order_relaxed);
+                totals.callback_time.counts[bucket] += shard.callback_time[bucket].load(std::memory_order_relaxed);
+            }
+        }
+        // Arms are read last so that they cover every settle seen above.
+        for (std::size_t i = 0; i < thread_shards + external_shards; ++i)
+        {
+            totals.arms += shards[i].arms.load(std::memory_order_relaxed);
+        }
+        totals.active = totals.arms > settled ? totals.arms - settled : 0;
+        totals.ready = claimed > totals.fires ? claimed - totals.fires : 0;
+        totals.cascades = cascades.load(std::memory_order_relaxed);
+        totals.wheel_entries = wheel_entries.load(std::memory_order_relaxed);
+        return totals;
+    }
+
+    // With wait_backend::timerfd, a descriptor that becomes readable when a
+    // tick is due or an arm needs the deadline reprogrammed, for an external
+    // epoll loop; -1 otherwise.
+    int native_handle() const noexcept
+    {
+        return poll_fd;
+    }
+    // Runs the timers that are due on the calling thread (or hands them to
+    // the workers) and reprograms the timerfd. Meant for a scheduler built
+    // with the timerfd backend and no dispatchers, called whenever
+    // native_handle() is readable. Returns the number of timers fired.
+    std::size_t poll()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        consume_descriptors();
+        auto fired = run_due(lock, observe());
+        program(next_due());
+        publish_next_tick();
+        return fired;
+    }
+
+    // The pollable core of a wait_backend::external scheduler. The owner
+    // waits until next_deadline(), nothing if no timer is armed, then calls
+    // advance(); callbacks run inline on that thread unless there are
+    // workers. The hook set with set_wakeup() is called, on the arming
+    // thread, whenever an arm needs an earlier deadline than the last one
+    // returned; set it before anything is armed.
+    std::optional<clock::time_point> next_deadline()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        drain();
+        auto due = next_due();
+        publish_next_tick();
+        return due;
+    }
+    // Runs every timer due by `now` and returns how many fired.
+    std::size_t advance(clock::time_point now)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        last_now.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+        auto fired = run_due(lock, now);
+        publish_next_tick();
+        return fired;
+    }
+    void set_wakeup(inplace_function<void()> hook) noexcept
+    {
+        wakeup_hook = std::move(hook);
+    }
+
+    // Fire-and-forget single-shot timer: no future and no shared state, the
+    // node goes back to the pool once the callback ran or was cancelled.
+    // Exceptions escaping the callback terminate, as with std::thread.
+    template <class Function, class... Args>
+    timer_handle post_at(clock::time_point deadline, Function&& f, Args&&... args)
+    {
+        auto& node = nodes.acquire();
+        node.released.store(true, std::memory_order_relaxed);
+        auto generation = arm(node, deadline, [f = std::forward<Function>(f), ...args = std::forward<Args>(args)](detail::timer_event event) mutable
+            -> std::optional<clock::time_point>
+        {
+            if (event == detail::timer_event::expired)
+            {
+                std::invoke(f, args...);
+            }
+            return std::nullopt;
+        });
+        return timer_handle(*this, node, generation);
+    }
+    template <class Rep, class Period, class Function, class... Args>
+    timer_handle post_after(std::chrono::duration<Rep, Period> delay, Function&& f, Args&&... args)
+    {
+        return post_at(now() + std::chrono::ceil<clock::duration>(delay), std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+    // Posts every spec like post_at, moving the callbacks out, and returns
+    // the handles in spec order. The whole batch reaches the dispatcher with
+    // one push in deadline order and wakes it at most once.
+    std::vector<timer_handle> arm_bulk(std::span<timer_spec> specs)
+    {
+        std::vector<timer_handle> handles;
+        std::vector<std::pair<clock::rep, std::uint32_t>> order;
+        handles.reserve(specs.size());
+        order.reserve(specs.size());
+        nodes.reserve(nodes.in_use() + specs.size());
+        try
+        {
+            for (auto& spec : specs)
+            {
+                auto& node = nodes.acquire();
+                node.released.store(true, std::memory_order_relaxed);
+                auto generation = prepare(node, spec.deadline, [f = std::move(spec.callback)](detail::timer_event event) mutable
+                    -> std::optional<clock::time_point>
+                {
+                    if (event == detail::timer_event::expired)
+                    {
+                        f();
+                    }
+                    return std::nullopt;
+                }, spec.slack);
+                order.emplace_back(spec.deadline.time_since_epoch().count(), static_cast<std::uint32_t>(handles.size()));
+                handles.push_back(timer_handle(*this, node, generation));
+            }
+        }
+        catch (...)
+        {
+            // Out of nodes: the part of the batch armed so far never fires.
+            for (auto& handle : handles)
+            {
+                cancel(*handle.node, handle.generation);
+            }
+            throw;
+        }
+        if (!std::is_sorted(order.begin(), order.end()))
+        {
+            std::sort(order.begin(), order.end());
+        }
+        pending_chain batch;
+        auto earliest = std::numeric_limits<std::uint64_t>::max();
+        for (auto [deadline, i] : order)
+        {
+            auto& node = *handles[i].node;
+            earliest = std::min(earliest, expiry_tick(specs[i].deadline, node.slack.load(std::memory_order_relaxed)));
+            batch.append(node);
+        }
+        push_pending(batch);
+        if (earliest < wake_tick.load())
+        {
+            notify();
+        }
+        return handles;
+    }
+    // Cancels every handle like timer_handle::cancel and returns how many
+    // timers will now never fire. Settled nodes go back to the dispatcher in
+    // one push.
+    std::size_t cancel_bulk(std::span<timer_handle> handles) noexcept
+    {
+        std::size_t cancelled {0};
+        pending_chain batch;
+        for (auto& handle : handles)
+        {
+            if (handle.node == nullptr)
+            {
+                continue;
+            }
+            if (handle.sched != this)
+            {
+                cancelled += handle.cancel() ? 1 : 0;
+                continue;
+            }
+            cancelled += cancel(*handle.node, handle.generation, &batch) == detail::timer_phase::armed ? 1 : 0;
+        }
+        push_pending(batch);
+        return cancelled;
+    }
+    // Single-shot timer that calls the callback bound to `tag` with `id`.
+    // Unlike other timers it shows up in snapshot().
+    timer_handle post_tagged(clock::time_point deadline, timer_registry& registry, std::uint32_t tag, std::uint64_t id)
+    {
+        auto& callback = registry.at(tag);
+        auto& node = nodes.acquire();
+        node.released.store(true, std::memory_order_relaxed);
+        auto generation = prepare(node, deadline, tagged_handler(callback, id), std::nullopt, tag, id);
+        enqueue(node, deadline);
+        return timer_handle(*this, node, generation);
+    }
+    // The tagged timers still to fire, in deadline order. Arms and cancels
+    // may go on meanwhile; each entry is a consistent read of one timer.
+    std::vector<timer_snapshot_entry> snapshot() const
+    {
+        std::vector<timer_snapshot_entry> entries;
+        const auto steady = now().time_since_epoch();
+        const auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch());
+        nodes.for_each([&](const detail::timer_node& node)
+        {
+            // Checked against the state word like a seqlock, as the node may
+            // be re-armed while it is read.
+            auto state = node.state.load(std::memory_order_acquire);
+            if (detail::phase_of(state) != detail::timer_phase::armed)
+            {
+                return;
+            }
+            auto tag = node.tag.load(std::memory_order_acquire);
+            auto id = node.id.load(std::memory_order_acquire);
+            auto deadline = clock::duration(node.deadline.load(std::memory_order_acquire));
+            if (tag == detail::timer_node::untagged || node.state.load() != state)
+            {
+                return;
+            }
+            entries.push_back({(wall + std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - steady)).count(), id, tag});
+        });
+        std::sort(entries.begin(), entries.end(), [](const timer_snapshot_entry& a, const timer_snapshot_entry& b)
+        {
+            return a.deadline < b.deadline;
+        });
+        return entries;
+    }
+    // Re-arms the timers of a snapshot in one batch, like arm_bulk, and
+    // returns how many it restored; entries whose tag is not bound are
+    // skipped. Deadlines that passed meanwhile fire right away.
+    std::size_t restore(std::span<const timer_snapshot_entry> entries, timer_registry& registry)
+    {
+        const auto steady = now();
+        const auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+        nodes.reserve(nodes.in_use() + entries.size());
+        pending_chain batch;
+        auto earliest = std::numeric_limits<std::uint64_t>::max();
+        std::size_t restored {0};
+        try
+        {
+            for (auto& entry : entries)
+            {
+                auto callback = registry.find(entry.tag);
+                if (callback == nullptr)
+                {
+                    continue;
+                }
+                auto deadline = steady + std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(entry.deadline - wall));
+                auto& node = nodes.acquire();
+                node.released.store(true, std::memory_order_relaxed);
+                prepare(node, deadline, tagged_handler(*callback, entry.id), std::nullopt, entry.tag, entry.id);
+                earliest = std::min(earliest, expiry_tick(deadline, node.slack.load(std::memory_order_relaxed)));
+                batch.append(node);
+                ++restored;
+            }
+        }
+        catch (...)
+        {
+            // Out of nodes: what was restored so far stays armed.
+            push_pending(batch);
+            notify();
+            throw;
+        }
+        push_pending(batch);
+        if (earliest < wake_tick.load())
+        {
+            notify();
+        }
+        return restored;
+    }
+    // Writes snapshot() to `path` as a snapshot_header and the entries. The
+    // file is written next to `path`, synced and renamed over it, and the
+    // directory synced after the rename, so neither a failed save nor a power
+    // loss leaves anything but the old or the new snapshot on Linux. Other
+    // systems only get the atomic rename.
+    void save_snapshot(const std::string& path) const
+    {
+        auto entries = snapshot();
+        detail::snapshot_header header;
+        header.count = entries.size();
+        auto staging = path + ".tmp";
+        {
+            std::ofstream out(staging, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(timer_snapshot_entry)));
+            out.flush();
+            if (!out)
+            {
+                std::error_code ignored;
+                std::filesystem::remove(staging, ignored);
+                throw std::system_error(std::make_error_code(std::errc::io_error), "async_timers::scheduler snapshot " + path);
+            }
+        }
+        auto error = detail::sync_to_disk(staging);
+        if (!error)
+        {
+            std::filesystem::rename(staging, path, error);
+        }
+        if (error)
+        {
+            std::error_code ignored;
+            std::filesystem::remove(staging, ignored);
+            throw std::system_error(error, "async_timers::scheduler snapshot " + path);
+        }
+        auto directory = std::filesystem::path(path).parent_path();
+        error = detail::sync_to_disk(directory.empty() ? std::filesystem::path(".") : directory, true);
+        if (error)
+        {
+            throw std::system_error(error, "async_timers::scheduler snapshot " + path);
+        }
+    }
+    // Restores a file written by save_snapshot().
+    std::size_t load_snapshot(const std::string& path, timer_registry& registry)
+    {
+        std::ifstream in(path, std::ios::binary);
+        detail::snapshot_header header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)) || !header.valid())
+        {
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "async_timers::scheduler snapshot " + path);
+        }
+        // The count comes from the file; it must fit in what follows the header.
+        auto body = in.tellg();
+        in.seekg(0, std::ios::end);
+        auto remaining = static_cast<std::uint64_t>(in.tellg() - body);
+        in.seekg(body);
+        if (!in || header.count > remaining / sizeof(timer_snapshot_entry))
+        {
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "async_timers::scheduler snapshot " + path);
+        }
+        std::vector<timer_snapshot_entry> entries(header.count);
+        if (!in.read(reinterpret_cast<char*>(entries.data()), static_cast<std::streamsize>(entries.size() * sizeof(timer_snapshot_entry))))
+        {
+            throw std::system_error(std::make_error_code(std::errc::io_error), "async_timers::scheduler snapshot " + path);
+        }
+        return restore(entries, registry);
+    }
+private:
+    template <class Trace, class Clock>
+    friend class basic_instance;
+    friend class timer_handle;
+    template <class Function>
+    friend class debouncer;
+    template <class Function>
+    friend class throttler;
+
+    // Nodes collected for one push onto an arm queue, which drain() takes
+    // from the front.
+    struct pending_chain
+    {
+        void append(detail::timer_node& node) noexcept
+        {
+            if (!node.queued.exchange(true))
+            {
+                node.refs.fetch_add(1, std::memory_order_relaxed);
+                node.next_queued = nullptr;
+                (tail != nullptr ? tail->next_queued : head) = &node;
+                tail = &node;
+            }
+        }
+
+        detail::timer_node* head {nullptr};
+        detail::timer_node* tail {nullptr};
+    };
+
+    static detail::timer_handler tagged_handler(timer_registry::callback& callback, std::uint64_t id)
+    {
+        return [&callback, id](detail::timer_event event) -> std::optional<clock::time_point>
+        {
+            if (event == detail::timer_event::expired)
+            {
+                callback(id);
+            }
+            return std::nullopt;
+        };
+    }
+
+    // The caller must own the node in the idle phase. Returns the generation
+    // of the new arm.
+    std::uint64_t arm(detail::timer_node& node, clock::time_point deadline, detail::timer_handler handler,
+                      std::optional<clock::duration> slack = std::nullopt) noexcept
+    {
+        auto generation = prepare(node, deadline, std::move(handler), slack);
+        enqueue(node, deadline);
+        return generation;
+    }
+    // Moves an idle node to armed without handing it to the dispatcher yet.
+    std::uint64_t prepare(detail::timer_node& node, clock::time_point deadline, detail::timer_handler handler,
+                          std::optional<clock::duration> slack, std::uint32_t tag = detail::timer_node::untagged, std::uint64_t id = 0) noexcept
+    {
+        auto generation = detail::generation_of(node.state.load(std::memory_order_relaxed)) + 1;
+        node.handler = std::move(handler);
+        node.deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+        node.tag.store(tag, std::memory_order_relaxed);
+        node.id.store(id, std::memory_order_relaxed);
+        auto slack_ticks = std::clamp<clock::rep>(slack.value_or(default_slack) / resolution, 0, std::numeric_limits<std::uint32_t>::max());
+        node.slack.store(static_cast<std::uint32_t>(slack_ticks), std::memory_order_relaxed);
+        node.state.store(detail::make_state(generation, detail::timer_phase::armed), std::memory_order_release);
+        detail::metrics_shard::count(shard().arms);
+        return generation;
+    }
+    // Returns true if the node was armed or firing.
+    bool cancel(detail::timer_node& node) noexcept
+    {
+        auto current = node.state.load();
+        for (; detail::phase_of(current) == detail::timer_phase::rescheduling; current = node.state.load())
+        {
+            detail::cpu_relax();
+        }
+        return cancel(node, detail::generation_of(current)) != detail::timer_phase::idle;
+    }
+    // Cancels the arm `generation` and returns the phase it was found in. An
+    // armed node completes right away, a firing one as soon as its handler
+    // returns; idle means the arm is long gone. With a batch, a settled node
+    // is collected there instead of pushed.
+    detail::timer_phase cancel(detail::timer_node& node, std::uint64_t generation, pending_chain* batch = nullptr) noexcept
+    {
+        auto current = node.state.load();
+        while (detail::generation_of(current) == generation)
+        {
+            auto phase = detail::phase_of(current);
+            switch (phase)
+            {
+            case detail::timer_phase::armed:
+                if (node.state.compare_exchange_weak(current, detail::make_state(generation, detail::timer_phase::cancelled)))
+                {
+                    detail::metrics_shard::count(shard().cancels);
+                    retire(node, generation, batch);
+                    return phase;
+                }
+                break;
+            case detail::timer_phase::firing:
+                // Counted by finish(), and only if it suppresses a re-arm: the
+                // running callback itself is not stopped.
+                if (node.state.compare_exchange_weak(current, detail::make_state(generation, detail::timer_phase::cancelled)))
+                {
+                    return phase;
+                }
+                break;
+            case detail::timer_phase::rescheduling:
+                // Ends up armed under the next generation, which this cancel
+                // does not apply to.
+                detail::cpu_relax();
+                current = node.state.load();
+                break;
+            default:
+                return phase;
+            }
+        }
+        return detail::timer_phase::idle;
+    }
+    // Re-arms `generation` under the next generation, which leaves the wheel
+    // entry for the old deadline stale. The arm is claimed before the
+    // deadline is written, so a thread that loses the race cannot move the
+    // deadline of whatever arm the node holds next.
+    bool reschedule(detail::timer_node& node, std::uint64_t generation, clock::time_point deadline) noexcept
+    {
+        auto current = detail::make_state(generation, detail::timer_phase::armed);
+        if (!node.state.compare_exchange_strong(current, detail::make_state(generation, detail::timer_phase::rescheduling)))
+        {
+            return false;
+        }
+        node.deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+        node.state.store(detail::make_state(generation + 1, detail::timer_phase::armed));
+        detail::metrics_shard::count(shard().reschedules);
+        enqueue(node, deadline);
+        return true;
+    }
+    static void wait_idle(detail::timer_node& node) noexcept
+    {
+        for (auto current = node.state.load(); detail::phase_of(current) == detail::timer_phase::firing ||
+             detail::phase_of(current) == detail::timer_phase::cancelled; current = node.state.load())
+        {
+            node.state.wait(current);
+        }
+    }
+    detail::timer_node& acquire()
+    {
+        return nodes.acquire();
+    }
+    // Hands an idle node back. It passes through an arm queue so the
+    // dispatcher unlinks any stale wheel entry before it returns to the pool.
+    void release(detail::timer_node& node) noexcept
+    {
+        node.released.store(true, std::memory_order_relaxed);
+        push_pending(node);
+        unref(node);
+    }
+    // Whoever drops the last reference owns the node, so a node settling
+    // while the dispatcher drains a stale queue entry of it goes back once.
+    void unref(detail::timer_node& node) noexcept
+    {
+        if (node.refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            nodes.release(node);
+        }
+    }
+    void retire(detail::timer_node& node, std::uint64_t generation, pending_chain* batch = nullptr) noexcept
+    {
+        node.handler(detail::timer_event::cancelled);
+        auto detached = node.released.load(std::memory_order_relaxed);
+        node.handler = nullptr;
+        detail::metrics_shard::count(shard().settled);
+        // Queued before it turns idle: the queue reference keeps the node out
+        // of the pool until the dispatcher has dropped its wheel entry.
+        if (detached && batch != nullptr)
+        {
+            batch->append(node);
+        }
+        else if (detached)
+        {
+            push_pending(node);
+        }
+        node.state.store(detail::make_state(generation, detail::timer_phase::idle));
+        node.state.notify_all();
+        if (detached)
+        {
+            unref(node);
+        }
+    }
+    void push_pending(detail::timer_node& node) noexcept
+    {
+        if (!node.queued.exchange(true))
+        {
+            node.refs.fetch_add(1, std::memory_order_relaxed);
+            auto& queue = queues[detail::thread_stripe() % queue_count].head;
+            auto head = queue.load(std::memory_order_relaxed);
+            do
+            {
+                node.next_queued = head;
+            }
+            while (!queue.compare_exchange_weak(head, &node));
+        }
+    }
+    void push_pending(pending_chain& batch) noexcept
+    {
+        if (batch.head == nullptr)
+        {
+            return;
+        }
+        auto& queue = queues[detail::thread_stripe() % queue_count].head;
+        auto head = queue.load(std::memory_order_relaxed);
+        do
+        {
+            batch.tail->next_queued = head;
+        }
+        while (!queue.compare_exchange_weak(head, batch.head));
+    }
+    // Pairs with the wake_tick check in enqueue(): a dispatcher that stored
+    // wake_tick and then finds every queue empty may sleep.
+    bool has_pending() const noexcept
+    {
+        for (std::size_t i = 0; i < queue_count; ++i)
+        {
+            if (queues[i].head.load() != nullptr)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    void enqueue(detail::timer_node& node, clock::time_point deadline) noexcept
+    {
+        push_pending(node);
+        if (expiry_tick(deadline, node.slack.load(std::memory_order_relaxed)) < wake_tick.load())
+        {
+            notify();
+        }
+    }
+    // Wakes one sleeping dispatcher.
+    void notify() noexcept
+    {
+        if (backend == wait_backend::timerfd)
+        {
+            signal_descriptor();
+            return;
+        }
+        if (backend == wait_backend::external)
+        {
+            if (wakeup_hook)
+            {
+                wakeup_hook();
+            }
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+        }
+        wakeup.notify_one();
+    }
+    void wake_all() noexcept
+    {
+        if (backend == wait_backend::timerfd)
+        {
+            signal_descriptor();
+            return;
+        }
+        if (backend == wait_backend::external)
+        {
+            return;
+        }
+        wakeup.notify_all();
+    }
+    // Moves freshly armed nodes into the wheel; requires the mutex.
+    void drain() noexcept
+    {
+        for (std::size_t i = 0; i < queue_count; ++i)
+        {
+            if (queues[i].head.load(std::memory_order_relaxed) != nullptr)
+            {
+                drain(queues[i].head.exchange(nullptr));
+            }
+        }
+        wheel_entries.store(wheel.entries(), std::memory_order_relaxed);
+    }
+    void drain(detail::timer_node* node) noexcept
+    {
+        while (node != nullptr)
+        {
+            auto next = node->next_queued;
+            node->queued.exchange(false);
+            if (wheel.contains(*node))
+            {
+                wheel.erase(*node);
+            }
+            auto current = node->state.load();
+            if (detail::phase_of(current) == detail::timer_phase::armed)
+            {
+                node->generation = detail::generation_of(current);
+                insert(*node, clock::time_point(clock::duration(node->deadline.load(std::memory_order_relaxed))));
+            }
+            unref(*node);
+            node = next;
+        }
+    }
+    void insert(detail::timer_node& node, clock::time_point deadline) noexcept
+    {
+        if (wheel.empty())
+        {
+            wheel.fast_forward(elapsed_ticks(now()));
+        }
+        wheel.insert(node, expiry_tick(deadline, node.slack.load(std::memory_order_relaxed)));
+    }
+    void run(std::size_t index)
+    {
+        local_shard = {this, &shards[index]};
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping)
+        {
+            drain();
+            if (wheel.empty())
+            {
+                wake_tick.store(std::numeric_limits<std::uint64_t>::max());
+                sleep(lock, std::nullopt);
+                observe();
+                wake_tick.store(0);
+                continue;
+            }
+            // Sleeps through idle ticks: the wheel names the next tick with
+            // anything to expire or cascade.
+            auto now = observe();
+            wheel.fast_forward(elapsed_ticks(now));
+            auto next = wheel.next_expiry();
+            auto due = origin + resolution * next;
+            if (now < due)
+            {
+                wake_tick.store(next);
+                sleep(lock, due);
+                observe();
+                wake_tick.store(0);
+                continue;
+            }
+            expire(lock, now);
+        }
+    }
+    // Waits for `due` or an earlier arm, unless an arm is already pending.
+    void sleep(std::unique_lock<std::mutex>& lock, std::optional<clock::time_point> due)
+    {
+        if (has_pending())
+        {
+            return;
+        }
+        if (strategy == wait_strategy::busy_poll)
+        {
+            spin(lock, due.value_or(clock::time_point::max()));
+            return;
+        }
+        if (strategy == wait_strategy::spin_then_block && due)
+        {
+            if (now() >= *due - spin_threshold)
+            {
+                spin(lock, *due);
+                return;
+            }
+            // Wake up early and spin out the rest on the next round.
+            *due -= spin_threshold;
+        }
+        if (backend == wait_backend::timerfd)
+        {
+            program(due);
+            lock.unlock();
+            wait_descriptors();
+            lock.lock();
+            // Leave the eventfd readable on shutdown so every dispatcher sees it.
+            if (!stopping)
+            {
+                consume_descriptors();
+            }
+        }
+        else if (due)
+        {
+            wakeup.wait_until(lock, *due);
+        }
+        else
+        {
+            wakeup.wait(lock, [this]
+            {
+                return stopping || has_pending();
+            });
+        }
+    }
+    // For a poll()ed or external scheduler: moves arms into the wheel and runs
+    // what is due by `now`; requires the mutex.
+    std::size_t run_due(std::unique_lock<std::mutex>& lock, clock::time_point now)
+    {
+        drain();
+        std::size_t fired {0};
+        if (!wheel.empty() && now >= origin + resolution * wheel.next_expiry())
+        {
+            fired = expire(lock, now);
+            drain();
+        }
+        return fired;
+    }
+    std::optional<clock::time_point> next_due() const noexcept
+    {
+        if (wheel.empty())
+        {
+            return std::nullopt;
+        }
+        return origin + resolution * wheel.next_expiry();
+    }
+    // Tells arming threads which tick the owner will next wake up for.
+    void publish_next_tick() noexcept
+    {
+        wake_tick.store(wheel.empty() ? std::numeric_limits<std::uint64_t>::max() : wheel.next_expiry());
+        // An arm that raced the store above is already on an arm queue.
+        if (has_pending())
+        {
+            notify();
+        }
+    }
+    // Reads the clock and publishes the reading for coarse_now().
+    clock::time_point observe() noexcept
+    {
+        auto current = now();
+        last_now.store(current.time_since_epoch().count(), std::memory_order_relaxed);
+        return current;
+    }
+    // Polls without the mutex until `until`, an arm or shutdown. Arms do not
+    // need to wake a spinning dispatcher.
+    void spin(std::unique_lock<std::mutex>& lock, clock::time_point until) noexcept
+    {
+        wake_tick.store(0);
+        lock.unlock();
+        while (!has_pending() && !stopping.load(std::memory_order_relaxed) && observe() < until)
+        {
+            detail::cpu_relax();
+        }
+        lock.lock();
+    }
+    // Claims and runs everything due by `now`; drops the mutex for the
+    // callbacks. Returns the number of timers claimed.
+    std::size_t expire(std::unique_lock<std::mutex>& lock, clock::time_point now)
+    {
+        std::size_t claimed {0};
+        detail::timer_list expired, firing;
+        wheel.advance(elapsed_ticks(now), expired);
+        cascades.store(wheel.cascaded(), std::memory_order_relaxed);
+        wheel_entries.store(wheel.entries(), std::memory_order_relaxed);
+        for (auto node = expired.pop_front(); node != nullptr; node = expired.pop_front())
+        {
+            auto expected = detail::make_state(node->generation, detail::timer_phase::armed);
+            if (node->state.compare_exchange_strong(expected, detail::make_state(node->generation, detail::timer_phase::firing)))
+            {
+                firing.push_back(*node);
+                ++claimed;
+            }
+        }
+        detail::metrics_shard::count(shard().claimed, claimed);
+        lock.unlock();
+        if (workers.empty())
+        {
+            while (auto node = firing.pop_front())
+            {
+                fire(*node);
+            }
+        }
+        else
+        {
+            hand_off(firing);
+        }
+        lock.lock();
+        return claimed;
+    }
+    void fire(detail::timer_node& node) noexcept
+    {
+        auto& counters = shard();
+        auto started = now();
+        counters.record(counters.lateness, started - clock::time_point(clock::duration(node.deadline.load(std::memory_order_relaxed))));
+        auto rearm = node.handler(detail::timer_event::expired);
+        counters.record(counters.callback_time, now() - started);
+        counters.count(counters.fires);
+        finish(node, rearm);
+    }
+    // Runs without the mutex, possibly on a worker: a periodic node goes back
+    // through an arm queue like any other arm.
+    void finish(detail::timer_node& node, std::optional<clock::time_point> rearm) noexcept
+    {
+        auto generation = node.generation;
+        if (rearm)
+        {
+            auto expected = detail::make_state(generation, detail::timer_phase::firing);
+            node.deadline.store(rearm->time_since_epoch().count(), std::memory_order_relaxed);
+            if (node.state.compare_exchange_strong(expected, detail::make_state(generation, detail::timer_phase::armed)))
+            {
+                enqueue(node, *rearm);
+                return;
+            }
+            detail::metrics_shard::count(shard().cancels);
+            node.handler(detail::timer_event::cancelled);
+        }
+        // Instances only mark their node released once it is idle, so the flag
+        // has to be read before giving up ownership.
+        auto detached = node.released.load(std::memory_order_relaxed);
+        node.handler = nullptr;
+        detail::metrics_shard::count(shard().settled);
+        node.state.store(detail::make_state(generation, detail::timer_phase::idle));
+        node.state.notify_all();
+        if (detached)
+        {
+            unref(node);
+        }
+    }
+    // Splits a batch of firing nodes evenly over the workers' inboxes.
+    void hand_off(detail::timer_list& firing) noexcept
+    {
+        std::size_t count {0};
+        firing.for_each([&count](detail::timer_node&)
+        {
+            ++count;
+        });
+        auto share = (count + workers.size() - 1) / workers.size();
+        while (!firing.empty())
+        {
+            auto& target = *workers[next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+            detail::timer_node* first = nullptr;
+            detail::timer_node* last = nullptr;
+            for (std::size_t i = 0; i < share && !firing.empty(); ++i)
+            {
+                auto node = firing.pop_front();
+                node->next = first;
+                first = node;
+                if (last == nullptr)
+                {
+                    last = node;
+                }
+            }
+            auto head = target.inbox.load(std::memory_order_relaxed);
+            do
+            {
+                last->next = head;
+            }
+            while (!target.inbox.compare_exchange_weak(head, first, std::memory_order_release));
+            target.signal.fetch_add(1);
+            target.signal.notify_one();
+        }
+    }
+    void work(std::size_t index)
+    {
+        local_shard = {this, &shards[thread_shards - workers.size() + index]};
+        auto& self = *workers[index];
+        detail::timer_node* overflow = nullptr;
+        for (;;)
+        {
+            auto signal = self.signal.load();
+            auto node = self.deque.pop();
+            if (node == nullptr)
+            {
+                for (auto ready = self.inbox.exchange(nullptr, std::memory_order_acquire); ready != nullptr;)
+                {
+                    auto next = ready->next;
+                    if (!self.deque.push(ready))
+                    {
+                        ready->next = overflow;
+                        overflow = ready;
+                    }
+                    ready = next;
+                }
+                node = self.deque.pop();
+            }
+            if (node == nullptr && overflow != nullptr)
+            {
+                node = std::exchange(overflow, overflow->next);
+            }
+            for (std::size_t i = 1; node == nullptr && i < workers.size(); ++i)
+            {
+                node = workers[(index + i) % workers.size()]->deque.steal();
+            }
+            if (node != nullptr)
+            {
+                fire(*node);
+                continue;
+            }
+            if (workers_stopping.load() && self.inbox.load() == nullptr)
+            {
+                return;
+            }
+            self.signal.wait(signal);
+        }
+    }
+    void open_descriptors()
+    {
+#if defined(__linux__)
+        timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        poll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+        auto error = timer_fd < 0 || wake_fd < 0 || poll_fd < 0 ? errno : 0;
+        for (auto fd : {timer_fd, wake_fd})
+        {
+            ::epoll_event event {};
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+            if (error == 0 && ::epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+            {
+                error = errno;
+            }
+        }
+        if (error != 0)
+        {
+            close_descriptors();
+            throw std::system_error(error, std::system_category(), "async_timers::scheduler timerfd backend");
+        }
+#else
+        throw std::system_error(std::make_error_code(std::errc::not_supported), "async_timers::scheduler timerfd backend");
+#endif
+    }
+    void close_descriptors() noexcept
+    {
+#if defined(__linux__)
+        for (auto fd : {poll_fd, wake_fd, timer_fd})
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+        }
+        poll_fd = wake_fd = timer_fd = -1;
+#endif
+    }
+    // Arms the timerfd for an absolute steady_clock deadline, which is
+    // CLOCK_MONOTONIC on Linux, or disarms it.
+    void program([[maybe_unused]] std::optional<clock::time_point> due) noexcept
+    {
+#if defined(__linux__)
+        ::itimerspec spec {};
+        if (due)
+        {
+            auto since_epoch = std::max(due->time_since_epoch(), clock::duration(1));
+            auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+            spec.it_value.tv_sec = static_cast<time_t>(seconds.count());
+            spec.it_value.tv_nsec = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch - seconds).count());
+        }
+        ::timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+#endif
+    }
+    void wait_descriptors() noexcept
+    {
+#if defined(__linux__)
+        ::epoll_event events[2];
+        while (::epoll_wait(poll_fd, events, 2, -1) < 0 && errno == EINTR)
+        {
+        }
+#endif
+    }
+    void consume_descriptors() noexcept
+    {
+#if defined(__linux__)
+        std::uint64_t count;
+        [[maybe_unused]] auto expirations = ::read(timer_fd, &count, sizeof(count));
+        [[maybe_unused]] auto wakeups = ::read(wake_fd, &count, sizeof(count));
+#endif
+    }
+    void signal_descriptor() noexcept
+    {
+#if defined(__linux__)
+        std::uint64_t one {1};
+        [[maybe_unused]] auto written = ::write(wake_fd, &one, sizeof(one));
+#endif
+    }
+    static void pin([[maybe_unused]] std::thread& thread, [[maybe_unused]] int cpu) noexcept
+    {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+#endif
+    }
+    static std::size_t arm_queue_count(const scheduler_options& options) noexcept
+    {
+        auto count = options.arm_queues != 0 ? options.arm_queues : std::thread::hardware_concurrency();
+        return std::clamp<std::size_t>(count, 1, 64);
+    }
+    static std::size_t dispatcher_threads(const scheduler_options& options) noexcept
+    {
+        switch (options.backend)
+        {
+        case wait_backend::timerfd:
+            return options.dispatchers;
+        case wait_backend::external:
+            return 0;
+        default:
+            return std::max<std::size_t>(options.dispatchers, 1);
+        }
+    }
+    // The calling thread's counters: its own as a dispatcher or worker of
+    // this scheduler, else one of the stripes shared by arming threads.
+    detail::metrics_shard& shard() noexcept
+    {
+        if (local_shard.owner == this)
+        {
+            return *local_shard.shard;
+        }
+        return shards[thread_shards + detail::thread_stripe() % external_shards];
+    }
+    std::uint64_t elapsed_ticks(clock::time_point t) const noexcept
+    {
+        return t <= origin ? 0 : static_cast<std::uint64_t>((t - origin) / resolution);
+    }
+    std::uint64_t ceil_ticks(clock::time_point t) const noexcept
+    {
+        auto ticks = elapsed_ticks(t);
+        return origin + resolution * ticks < t ? ticks + 1 : ticks;
+    }
+    // The standard library's own functions may not have their address taken.
+    static clock::time_point steady_now() noexcept
+    {
+        return clock::now();
+    }
+    static std::uint64_t expiry_tick(std::uint64_t tick, std::uint64_t slack) noexcept
+    {
+        return slack > 1 ? (tick + slack - 1) / slack * slack : tick;
+    }
+    std::uint64_t expiry_tick(clock::time_point deadline, std::uint64_t slack) const noexcept
+    {
+        return expiry_tick(ceil_ticks(deadline), slack);
+    }
+private:
+    clock::time_point (*const read_clock)() noexcept;
+    const clock::duration resolution;
+    const clock::time_point origin;
+    const clock::duration default_slack;
+    const wait_backend backend;
+    const wait_strategy strategy;
+    const clock::duration spin_threshold;
+    static constexpr std::size_t external_shards {4};
+    const std::size_t thread_shards;
+    std::unique_ptr<detail::metrics_shard[]> shards;
+    struct alignas(64) arm_queue
+    {
+        std::atomic<detail::timer_node*> head {nullptr};
+    };
+    const std::size_t queue_count;
+    std::unique_ptr<arm_queue[]> queues;
+    struct shard_binding
+    {
+        const scheduler* owner;
+        detail::metrics_shard* shard;
+    };
+    static inline thread_local shard_binding local_shard {};
+    std::atomic<std::uint64_t> cascades {0};
+    std::atomic<std::size_t> wheel_entries {0};
+    int timer_fd {-1};
+    int wake_fd {-1};
+    int poll_fd {-1};
+    detail::node_pool nodes;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    inplace_function<void()> wakeup_hook;
+    std::atomic<std::uint64_t> wake_tick {0};
+    detail::timer_wheel wheel {nodes};
+    std::atomic_bool stopping {false};
+    std::atomic<clock::rep> last_now {0};
+    std::vector<std::thread> dispatchers;
+
+    struct worker
+    {
+        detail::steal_deque<detail::timer_node> deque;
+        std::atomic<detail::timer_node*> inbox {nullptr};
+        std::atomic<std::uint32_t> signal {0};
+        std::thread thread;
+    };
+    std::vector<std::unique_ptr<worker>> workers;
+    std::atomic<std::size_t> next_worker {0};
+    std::atomic_bool workers_stopping {false};
+};
+
+inline bool timer_handle::cancel() noexcept
+{
+    return node != nullptr && sched->cancel(*node, generation) == detail::timer_phase::armed;
+}
+
+inline bool timer_handle::reschedule_after(std::chrono::steady_clock::duration delay) noexcept
+{
+    return node != nullptr && reschedule(sched->now() + delay);
+}
+
+inline bool timer_handle::reschedule(std::chrono::steady_clock::time_point deadline) noexcept
+{
+    if (node == nullptr || !sched->reschedule(*node, generation, deadline))
+    {
+        return false;
+    }
+    ++generation;
+    return true;
+}
+
+namespace detail
+{
+// Parses a sysfs CPU or node list such as "0-3,8,10-11".
+inline std::vector<int> parse_cpu_list(const std::string& list)
+{
+    std::vector<int> ids;
+    std::size_t position = 0;
+    while (position < list.size())
+    {
+        auto end = list.find(',', position);
+        auto item = list.substr(position, end == std::string::npos ? std::string::npos : end - position);
+        auto dash = item.find('-');
+        try
+        {
+            auto first = std::stoi(item.substr(0, dash));
+            auto last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (auto id = first; id <= last; ++id)
+            {
+                ids.push_back(id);
+            }
+        }
+        catch (const std::exception&)
+        {
+        }
+        position = end == std::string::npos ? list.size() : end + 1;
+    }
+    return ids;
+}
+
+inline std::vector<int> read_cpu_list(const std::string& path)
+{
+    std::ifstream file(path);
+    std::string list;
+    std::getline(file, list);
+    return parse_cpu_list(list);
+}
+
+// The CPUs of each NUMA node, or every CPU as one group where the topology
+// cannot be read. With `count` set the CPUs are instead cut, in node order,
+// into that many contiguous groups, so groups never straddle nodes unless
+// there are fewer groups than nodes.
+inline std::vector<std::vector<int>> cpu_groups(std::size_t count)
+{
+    std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+    for (auto node : read_cpu_list("/sys/devices/system/node/online"))
+    {
+        auto cpus = read_cpu_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!cpus.empty())
+        {
+            nodes.push_back(std::move(cpus));
+        }
+    }
+#endif
+    if (nodes.empty())
+    {
+        nodes.emplace_back();
+        for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency(); ++cpu)
+        {
+            nodes.back().push_back(static_cast<int>(cpu));
+        }
+    }
+    if (count == 0 || count == nodes.size())
+    {
+        return nodes;
+    }
+    std::vector<int> all;
+    for (auto& node : nodes)
+    {
+        all.insert(all.end(), node.begin(), node.end());
+    }
+    std::vector<std::vector<int>> groups(count);
+    for (std::size_t i = 0; i < all.size(); ++i)
+    {
+        groups[i * count / all.size()].push_back(all[i]);
+    }
+    return groups;
+}
+
+// Restricts the calling thread to `cpus`; threads it starts inherit that.
+inline void pin_current_thread([[maybe_unused]] const std::vector<int>& cpus) noexcept
+{
+#if defined(__linux__)
+    if (cpus.empty())
+    {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus)
+    {
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+        {
+            CPU_SET(cpu, &set);
+        }
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+inline int current_cpu() noexcept
+{
+#if defined(__linux__)
+    return sched_getcpu();
+#else
+    return -1;
+#endif
+}
+}
+
+// Independent schedulers, one per NUMA node or group of cores, each with
+// its own wheel, node pool and threads. Every shard is built on a thread
+// restricted to its CPUs: its dispatchers and workers inherit that
+// affinity, and first-touch placement keeps its memory on the node.
+// Arming through local() stays on the caller's node; an instance binds to a
+// shard by being constructed with shard(i) or shard_for(key).
+class sharded_scheduler
+{
+public:
+    // With `shard_count` 0 there is one shard per NUMA node. `options`
+    // apply to every shard.
+    explicit sharded_scheduler(std::size_t shard_count = 0, const scheduler_options& options = {})
+        : groups(detail::cpu_groups(shard_count))
+    {
+        for (std::size_t i = 0; i < groups.size(); ++i)
+        {
+            for (auto cpu : groups[i])
+            {
+                if (cpu >= static_cast<int>(cpu_shard.size()))
+                {
+                    cpu_shard.resize(static_cast<std::size_t>(cpu) + 1, npos);
+                }
+                cpu_shard[static_cast<std::size_t>(cpu)] = i;
+            }
+        }
+        shards.reserve(groups.size());
+        for (auto& cpus : groups)
+        {
+            std::unique_ptr<scheduler> shard;
+            std::exception_ptr error;
+            std::thread([&shard, &error, &cpus, &options]
+            {
+                detail::pin_current_thread(cpus);
+                try
+                {
+                    shard = std::make_unique<scheduler>(options);
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+            }).join();
+            if (error)
+            {
+                std::rethrow_exception(error);
+            }
+            shards.push_back(std::move(shard));
+        }
+    }
+
+    std::size_t size() const noexcept
+    {
+        return shards.size();
+    }
+    scheduler& shard(std::size_t index) noexcept
+    {
+        return *shards[index];
+    }
+    // Spreads timers by an affinity key, e.g. a connection or tenant id.
+    scheduler& shard_for(std::uint64_t key) noexcept
+    {
+        return *shards[key % shards.size()];
+    }
+    // The shard of the CPU the caller runs on; threads on CPUs outside every
+    // group are spread over the shards.
+    scheduler& local() noexcept
+    {
+        auto cpu = detail::current_cpu();
+        if (cpu >= 0 && static_cast<std::size_t>(cpu) < cpu_shard.size() && cpu_shard[static_cast<std::size_t>(cpu)] != npos)
+        {
+            return *shards[cpu_shard[static_cast<std::size_t>(cpu)]];
+        }
+        return *shards[detail::thread_stripe() % shards.size()];
+    }
+    // The CPUs shard `index` runs on; empty if unknown.
+    const std::vector<int>& cpus(std::size_t index) const noexcept
+    {
+        return groups[index];
+    }
+
+    template <class Function, class... Args>
+    timer_handle post_at(scheduler::clock::time_point deadline, Function&& f, Args&&... args)
+    {
+        return local().post_at(deadline, std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+    template <class Rep, class Period, class Function, class... Args>
+    timer_handle post_after(std::chrono::duration<Rep, Period> delay, Function&& f, Args&&... args)
+    {
+        return local().post_after(delay, std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+    scheduler_metrics metrics() const noexcept
+    {
+        scheduler_metrics totals;
+        for (auto& shard : shards)
+        {
+            totals += shard->metrics();
+        }
+        return totals;
+    }
+private:
+    static constexpr std::size_t npos {std::numeric_limits<std::size_t>::max()};
+
+    std::vector<std::vector<int>> groups;
+    std::vector<std::size_t> cpu_shard;
+    std::vector<std::unique_ptr<scheduler>> shards;
+};
+
+// Bounded single-producer single-consumer queue for the results of one
+// streaming timer. The producing side may move between dispatchers and
+// workers, as the runs of one timer never overlap.
+template <class T, std::size_t Capacity = 64>
+class result_ring
+{
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+public:
+    result_ring() noexcept = default;
+    result_ring(const result_ring&) = delete;
+    result_ring& operator=(const result_ring&) = delete;
+    ~result_ring()
+    {
+        while (try_pop())
+        {
+        }
+    }
+
+    // Producer side. Drops the value and returns false while the ring is full.
+    template <class... Args>
+    bool try_emplace(Args&&... args)
+    {
+        auto position = tail.load(std::memory_order_relaxed);
+        if (position - cached_head == Capacity)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (position - cached_head == Capacity)
+            {
+                dropped_count.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        ::new (static_cast<void*>(slots[position & (Capacity - 1)].bytes)) T(std::forward<Args>(args)...);
+        tail.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    bool try_push(T&& value)
+    {
+        return try_emplace(std::move(value));
+    }
+    bool try_push(const T& value)
+    {
+        return try_emplace(value);
+    }
+    // Consumer side.
+    std::optional<T> try_pop()
+    {
+        auto position = head.load(std::memory_order_relaxed);
+        if (position == cached_tail)
+        {
+            cached_tail = tail.load(std::memory_order_acquire);
+            if (position == cached_tail)
+            {
+                return std::nullopt;
+            }
+        }
+        auto& item = *std::launder(reinterpret_cast<T*>(slots[position & (Capacity - 1)].bytes));
+        std::optional<T> value(std::move(item));
+        item.~T();
+        head.store(position + 1, std::memory_order_release);
+        return value;
+    }
+    std::size_t size() const noexcept
+    {
+        return static_cast<std::size_t>(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+    }
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+    static constexpr std::size_t capacity() noexcept
+    {
+        return Capacity;
+    }
+    // Values refused by a full ring.
+    std::uint64_t dropped() const noexcept
+    {
+        return dropped_count.load(std::memory_order_relaxed);
+    }
+private:
+    struct slot
+    {
+        alignas(T) unsigned char bytes[sizeof(T)];
+    };
+
+    // The consumer's line, then the producer's.
+    alignas(64) std::atomic<std::uint64_t> head {0};
+    std::uint64_t cached_tail {0};
+    alignas(64) std::atomic<std::uint64_t> tail {0};
+    std::uint64_t cached_head {0};
+    std::atomic<std::uint64_t> dropped_count {0};
+    alignas(64) std::array<slot, Capacity> slots;
+};
+
+// Trace receives the trace_event hooks. Clock times legacy timers, which
+// have no scheduler to read it from; it has to share steady_clock's time
+// points, as tsc_clock does.
+template <class Trace = no_trace, class Clock = std::chrono::steady_clock>
+class basic_instance
+{
+    static_assert(std::is_same_v<typename Clock::time_point, std::chrono::steady_clock::time_point>,
+                  "Clock must use steady_clock time points");
+public:
+    basic_instance() noexcept : is_single_shot(true) {}
+    explicit basic_instance(scheduler& shared) : is_single_shot(true), sched(&shared), node(&shared.acquire()) {}
+    basic_instance(const basic_instance&) = delete;
+    basic_instance(basic_instance&& timer) = delete;
+    basic_instance& operator=(const basic_instance&) = delete;
+    basic_instance& operator=(basic_instance&&) = delete;
+    ~basic_instance()
+    {
+        if (sched != nullptr)
+        {
+            sched->cancel(*node);
+            sched->wait_idle(*node);
+            sched->release(*node);
+            return;
+        }
+        // Detached legacy threads refer to this instance until they return.
+        if (detached.load(std::memory_order_acquire) != 0)
+        {
+            stop();
+            while (detached.load(std::memory_order_acquire) != 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // `f` and `args` are copied or moved into the timer once, as std::thread
+    // does, and passed as lvalues to every call: a periodic callback sees the
+    // same objects each round and takes them by reference, so move-only and
+    // large arguments are neither copied nor consumed per tick.
+    template <class Rep, class Period = std::ratio<1>, class Function, class... Args>
+    std::future<detail::callback_result_t<Function, Args...>>
+    start(std::chrono::duration<Rep, Period> duration, Function&& f, Args&&... args)
+    {
+        if (sched != nullptr)
+        {
+            detail::pending_result<detail::callback_result_t<Function, Args...>> result;
+            auto future = result.promise.get_future();
+            schedule(std::move(result), duration, std::nullopt, std::forward<Function>(f), std::forward<Args>(args)...);
+            return future;
+        }
+        using result_type = detail::callback_result_t<Function, Args...>;
+        return std::async(std::launch::async, spawn(detail::returned_result<result_type>(), duration, std::forward<Function>(f), std::forward<Args>(args)...));
+    }
+    // Same as start(), but the callback may run up to `slack` late so that the
+    // scheduler can fire it together with timers due around the same time.
+    // Legacy timers have a thread of their own and ignore the slack.
+    template <class Rep, class Period, class SlackRep, class SlackPeriod, class Function, class... Args>
+    std::future<detail::callback_result_t<Function, Args...>>
+    start(std::chrono::duration<Rep, Period> duration, std::chrono::duration<SlackRep, SlackPeriod> slack, Function&& f, Args&&... args)
+    {
+        if (sched != nullptr)
+        {
+            detail::pending_result<detail::callback_result_t<Function, Args...>> result;
+            auto future = result.promise.get_future();
+            schedule(std::move(result), duration, std::chrono::ceil<scheduler::clock::duration>(slack), std::forward<Function>(f), std::forward<Args>(args)...);
+            return future;
+        }
+        return start(duration, std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+    // Same as start() without a future: on a scheduler this arms the node with
+    // no shared state at all, return values are discarded and exceptions
+    // terminate as they would on a std::thread. The handle cancels or
+    // reschedules just this arm; legacy timers return an empty one.
+    template <class Rep, class Period = std::ratio<1>, class Function, class... Args>
+    timer_handle start_detached(std::chrono::duration<Rep, Period> duration, Function&& f, Args&&... args)
+    {
+        if (sched != nullptr)
+        {
+            return schedule(detail::discarded_result(), duration, std::nullopt, std::forward<Function>(f), std::forward<Args>(args)...);
+        }
+        detach(detail::discarded_result(), duration, std::forward<Function>(f), std::forward<Args>(args)...);
+        return {};
+    }
+    // Same as start_detached(), but every value the callback returns, each
+    // round of a periodic timer included, is moved into `sink` on the thread
+    // that ran the callback. Nothing is default-constructed or copied.
+    template <class Rep, class Period = std::ratio<1>, class Sink, class Function, class... Args>
+    timer_handle start_streaming(std::chrono::duration<Rep, Period> duration, Sink&& sink, Function&& f, Args&&... args)
+    {
+        static_assert(!std::is_void_v<detail::callback_result_t<Function, Args...>>, "a streaming callback has to return a value");
+        detail::streamed_result<std::decay_t<Sink>> result {std::forward<Sink>(sink)};
+        if (sched != nullptr)
+        {
+            return schedule(std::move(result), duration, std::nullopt, std::forward<Function>(f), std::forward<Args>(args)...);
+        }
+        detach(std::move(result), duration, std::forward<Function>(f), std::forward<Args>(args)...);
+        return {};
+    }
+    // Streams into `ring`; results that find it full are dropped and show in
+    // ring.dropped(). The ring must outlive the arm.
+    template <class Rep, class Period = std::ratio<1>, class T, std::size_t Capacity, class Function, class... Args>
+    timer_handle start_streaming(std::chrono::duration<Rep, Period> duration, result_ring<T, Capacity>& ring, Function&& f, Args&&... args)
+    {
+        return start_streaming(duration, [&ring](auto&& value)
+        {
+            ring.try_emplace(std::forward<decltype(value)>(value));
+        }, std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+    void stop() noexcept
+    {
+        if (sched != nullptr)
+        {
+            sched->cancel(*node);
+            return;
+        }
+        auto current = state.load();
+        for (;;)
+        {
+            auto generation = detail::generation_of(current);
+            switch (detail::phase_of(current))
+            {
+            case detail::timer_phase::armed:
+                if (state.compare_exchange_weak(current, detail::make_state(generation, detail::timer_phase::idle)))
+                {
+                    interrupt();
+                    return;
+                }
+                break;
+            case detail::timer_phase::firing:
+                if (state.compare_exchange_weak(current, detail::make_state(generation, detail::timer_phase::cancelled)))
+                {
+                    return;
+                }
+                break;
+            default:
+                return;
+            }
+        }
+    }
+    void set_single_shot()
+    {
+        is_single_shot.store(true);
+    }
+    void set_periodic(catch_up policy = catch_up::skip)
+    {
+        missed_ticks.store(policy);
+        is_single_shot.store(false);
+    }
+private:
+    // Body of the legacy timer thread; `result` takes each return value and
+    // produces the body's own.
+    template <class Result, class Rep, class Period, class Function, class... Args>
+    auto spawn(Result result, std::chrono::duration<Rep, Period> duration, Function&& f, Args&&... args)
+    {
+        auto generation = claim();
+        detail::cadence ticks(Clock::now(), std::chrono::ceil<std::chrono::steady_clock::duration>(duration));
+        return [this, generation, ticks, result = std::move(result), f = std::forward<Function>(f), ...args = std::forward<Args>(args)]() mutable
+        {
+            Trace::on(trace_event::thread_started);
+            const auto armed = detail::make_state(generation, detail::timer_phase::armed);
+            const auto firing = detail::make_state(generation, detail::timer_phase::firing);
+            while (clock(armed, ticks.deadline()))
+            {
+                auto expected = armed;
+                if (!state.compare_exchange_strong(expected, firing))
+                {
+                    break;
+                }
+                try
+                {
+                    result.store([&]() -> decltype(auto)
+                    {
+                        return std::invoke(f, args...);
+                    });
+                }
+                catch (...)
+                {
+                    settle(generation);
+                    throw;
+                }
+                if (is_single_shot.load())
+                {
+                    Trace::on(trace_event::single_shot_finished);
+                    settle(generation);
+                    return result.finish();
+                }
+                ticks.advance(Clock::now(), missed_ticks.load());
+                expected = firing;
+                if (!state.compare_exchange_strong(expected, armed))
+                {
+                    settle(generation);
+                    return result.finish();
+                }
+            }
+            Trace::on(trace_event::stopped_prematurely);
+            return result.finish();
+        };
+    }
+    // Runs a legacy timer on a thread of its own that the destructor waits
+    // for.
+    template <class Result, class Rep, class Period, class Function, class... Args>
+    void detach(Result result, std::chrono::duration<Rep, Period> duration, Function&& f, Args&&... args)
+    {
+        auto body = spawn(std::move(result), duration, std::forward<Function>(f), std::forward<Args>(args)...);
+        auto claimed = state.load();
+        // Counted before the thread exists so it cannot finish first; one
+        // that fails to start must not keep the destructor waiting, nor leave
+        // its arm behind.
+        detached.fetch_add(1, std::memory_order_relaxed);
+        try
+        {
+            std::thread([this, body = std::move(body)]() mutable
+            {
+                body();
+                detached.fetch_sub(1, std::memory_order_release);
+            }).detach();
+        }
+        catch (...)
+        {
+            detached.fetch_sub(1, std::memory_order_release);
+            if (state.compare_exchange_strong(claimed, detail::make_state(detail::generation_of(claimed), detail::timer_phase::idle)))
+            {
+                state.notify_all();
+            }
+            throw;
+        }
+    }
+    template <class Result, class Rep, class Period, class Function, class... Args>
+    timer_handle schedule(Result result, std::chrono::duration<Rep, Period> duration, std::optional<scheduler::clock::duration> slack,
+                  Function&& f, Args&&... args)
+    {
+        if (sched->cancel(*node))
+        {
+            Trace::on(trace_event::restart_requested);
+            sched->wait_idle(*node);
+            Trace::on(trace_event::restarting);
+        }
+        detail::cadence ticks(sched->now(), std::chrono::ceil<scheduler::clock::duration>(duration));
+        auto first = ticks.deadline();
+        auto handler = [this, result = std::move(result), ticks, f = std::forward<Function>(f), ...args = std::forward<Args>(args)](detail::timer_event event) mutable
+            -> std::optional<scheduler::clock::time_point>
+        {
+            if (event == detail::timer_event::cancelled)
+            {
+                result.finish();
+                return std::nullopt;
+            }
+            try
+            {
+                result.store([&]() -> decltype(auto)
+                {
+                    return std::invoke(f, args...);
+                });
+            }
+            catch (...)
+            {
+                result.fail(std::current_exception());
+                return std::nullopt;
+            }
+            if (is_single_shot.load())
+            {
+                result.finish();
+                return std::nullopt;
+            }
+            return ticks.advance(sched->now(), missed_ticks.load());
+        };
+        return timer_handle(*sched, *node, sched->arm(*node, first, std::move(handler), slack));
+    }
+    // Takes ownership of the legacy timer for a new arm and returns its
+    // generation. A pending wait is superseded, a running callback is asked
+    // to stop and waited for.
+    std::uint64_t claim()
+    {
+        auto restarted = false;
+        auto current = state.load();
+        for (;;)
+        {
+            auto generation = detail::generation_of(current);
+            switch (detail::phase_of(current))
+            {
+            case detail::timer_phase::idle:
+                if (state.compare_exchange_weak(current, detail::make_state(generation + 1, detail::timer_phase::armed)))
+                {
+                    if (restarted)
+                    {
+                        Trace::on(trace_event::restarting);
+                    }
+                    return generation + 1;
+                }
+                break;
+            case detail::timer_phase::armed:
+                if (state.compare_exchange_weak(current, detail::make_state(generation + 1, detail::timer_phase::armed)))
+                {
+                    Trace::on(trace_event::restart_requested);
+                    interrupt();
+                    Trace::on(trace_event::restarting);
+                    return generation + 1;
+                }
+                break;
+            case detail::timer_phase::firing:
+                if (state.compare_exchange_weak(current, detail::make_state(generation, detail::timer_phase::cancelled)))
+                {
+                    Trace::on(trace_event::restart_requested);
+                    restarted = true;
+                }
+                break;
+            case detail::timer_phase::cancelled:
+                state.wait(current);
+                current = state.load();
+                break;
+            case detail::timer_phase::rescheduling:
+                // Only scheduler nodes pass through it.
+                current = state.load();
+                break;
+            }
+        }
+    }
+    void settle(std::uint64_t generation) noexcept
+    {
+        state.store(detail::make_state(generation, detail::timer_phase::idle));
+        state.notify_all();
+    }
+    // Wakes the legacy timer thread out of clock() instead of letting it
+    // sleep out the remaining duration.
+    void interrupt() noexcept
+    {
+        {
+            std::lock_guard<std::mutex> lock(wait_cond_mutex);
+        }
+        wait_cond.notify_all();
+    }
+    // Returns false once the timer no longer is in the armed state word.
+    bool clock(std::uint64_t armed, std::chrono::steady_clock::time_point deadline)
+    {
+        Trace::on(trace_event::clock_started);
+        std::unique_lock<std::mutex> lock(wait_cond_mutex);
+        wait_cond.wait_until(lock, deadline, [this, armed]
+        {
+            return state.load() != armed;
+        });
+        return state.load() == armed;
+    }
+private:
+    std::atomic_bool is_single_shot;
+    std::atomic<catch_up> missed_ticks {catch_up::skip};
+    std::atomic<std::uint64_t> state {0};
+    std::condition_variable wait_cond;
+    std::mutex wait_cond_mutex;
+    scheduler* sched {nullptr};
+    detail::timer_node* node {nullptr};
+    std::atomic<std::size_t> detached {0};
+};
+
+using instance = basic_instance<>;
+
+// Scheduler behind the awaitables when none is given. Started on first use.
+inline scheduler& default_scheduler()
+{
+    static scheduler shared;
+    return shared;
+}
+
+// Awaitable returned by sleep_until()/sleep_for(). The coroutine resumes on
+// the scheduler's dispatcher or worker thread; one destroyed with the
+// scheduler while still asleep is never resumed.
+class sleep_awaiter
+{
+public:
+    sleep_awaiter(scheduler& owner, scheduler::clock::time_point when) noexcept : sched(&owner), deadline(when) {}
+
+    bool await_ready() const noexcept
+    {
+        return deadline <= sched->now();
+    }
+    void await_suspend(std::coroutine_handle<> coroutine)
+    {
+        sched->post_at(deadline, [coroutine]
+        {
+            coroutine.resume();
+        });
+    }
+    void await_resume() const noexcept {}
+private:
+    scheduler* sched;
+    scheduler::clock::time_point deadline;
+};
+
+inline sleep_awaiter sleep_until(scheduler::clock::time_point deadline, scheduler& owner = default_scheduler()) noexcept
+{
+    return sleep_awaiter(owner, deadline);
+}
+template <class Rep, class Period>
+sleep_awaiter sleep_for(std::chrono::duration<Rep, Period> delay, scheduler& owner = default_scheduler()) noexcept
+{
+    return sleep_awaiter(owner, owner.now() + std::chrono::ceil<scheduler::clock::duration>(delay));
+}
+
+// What with_timeout() resolves to: the value, or nothing on timeout; true or
+// false for operations without a value.
+template <class T>
+using timeout_result = std::conditional_t<std::is_void_v<T>, bool, std::optional<std::remove_cvref_t<T>>>;
+
+namespace detail
+{
+template <class Awaitable>
+decltype(auto) awaiter_of(Awaitable&& awaitable)
+{
+    if constexpr (requires { std::forward<Awaitable>(awaitable).operator co_await(); })
+    {
+        return std::forward<Awaitable>(awaitable).operator co_await();
+    }
+    else if constexpr (requires { operator co_await(std::forward<Awaitable>(awaitable)); })
+    {
+        return operator co_await(std::forward<Awaitable>(awaitable));
+    }
+    else
+    {
+        return std::forward<Awaitable>(awaitable);
+    }
+}
+
+template <class Awaitable>
+concept awaitable = requires(Awaitable&& a)
+{
+    awaiter_of(std::forward<Awaitable>(a)).await_ready();
+};
+
+template <class Awaitable>
+using await_result_t = decltype(awaiter_of(std::declval<Awaitable>()).await_resume());
+
+// Shared by the waiting coroutine, the timer and the operation; whoever sets
+// `settled` first decides the outcome and resumes the waiter.
+template <class T>
+struct timeout_state
+{
+    std::atomic_bool settled {false};
+    std::coroutine_handle<> waiter;
+    timer_handle timer;
+    timeout_result<T> result {};
+    std::exception_ptr error;
+};
+
+// Eager, self-destroying coroutine that runs the raced operation. Frames
+// come from the block cache like the futures' shared state.
+struct timeout_runner
+{
+    struct promise_type
+    {
+        timeout_runner get_return_object() noexcept
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+        static void* operator new(std::size_t bytes)
+        {
+            return block_cache::allocate(bytes);
+        }
+        static void operator delete(void* p, std::size_t bytes) noexcept
+        {
+            block_cache::deallocate(p, bytes);
+        }
+    };
+};
+
+template <class T, class Awaitable>
+timeout_runner race(Awaitable operation, std::shared_ptr<timeout_state<T>> state)
+{
+    try
+    {
+        if constexpr (std::is_void_v<T>)
+        {
+            co_await std::move(operation);
+            if (!state->settled.exchange(true))
+            {
+                state->result = true;
+                state->timer.cancel();
+                state->waiter.resume();
+            }
+        }
+        else
+        {
+            auto&& value = co_await std::move(operation);
+            if (!state->settled.exchange(true))
+            {
+                state->result.emplace(std::forward<decltype(value)>(value));
+                state->timer.cancel();
+                state->waiter.resume();
+            }
+        }
+    }
+    catch (...)
+    {
+        if (!state->settled.exchange(true))
+        {
+            state->error = std::current_exception();
+            state->timer.cancel();
+            state->waiter.resume();
+        }
+    }
+}
+}
+
+// Awaitable returned by with_timeout(). On timeout the operation keeps
+// running to completion, its result is dropped.
+template <class Awaitable>
+class timeout_awaiter
+{
+public:
+    using value_type = detail::await_result_t<Awaitable>;
+
+    timeout_awaiter(Awaitable&& awaited, scheduler& owner, scheduler::clock::time_point when)
+        : operation(std::move(awaited)), sched(&owner), deadline(when),
+          state(std::allocate_shared<detail::timeout_state<value_type>>(detail::recycling_allocator<detail::timeout_state<value_type>>())) {}
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+    // Either side may resume the coroutine, and so destroy this awaiter,
+    // before await_suspend() returns: nothing here touches members once the
+    // timer is armed.
+    void await_suspend(std::coroutine_handle<> coroutine)
+    {
+        auto shared = state;
+        auto raced = std::move(operation);
+        shared->waiter = coroutine;
+        shared->timer = sched->post_at(deadline, [shared]
+        {
+            if (!shared->settled.exchange(true))
+            {
+                shared->waiter.resume();
+            }
+        });
+        detail::race<value_type>(std::move(raced), std::move(shared));
+    }
+    timeout_result<value_type> await_resume()
+    {
+        if (state->error)
+        {
+            std::rethrow_exception(state->error);
+        }
+        return std::move(state->result);
+    }
+private:
+    Awaitable operation;
+    scheduler* sched;
+    scheduler::clock::time_point deadline;
+    std::shared_ptr<detail::timeout_state<value_type>> state;
+};
+
+// Races an awaitable against a scheduler timer without any extra thread;
+// whichever finishes first resumes the caller, and completion cancels the
+// timer in O(1).
+template <detail::awaitable Awaitable, class Rep, class Period>
+timeout_awaiter<std::remove_cvref_t<Awaitable>> with_timeout(Awaitable&& operation, std::chrono::duration<Rep, Period> timeout,
+                                                            scheduler& owner = default_scheduler())
+{
+    return timeout_awaiter<std::remove_cvref_t<Awaitable>>(std::remove_cvref_t<Awaitable>(std::forward<Awaitable>(operation)), owner,
+                                                            owner.now() + std::chrono::ceil<scheduler::clock::duration>(timeout));
+}
+// Blocking flavour for futures: waits on the calling thread instead of a
+// second timer thread. The future stays valid after a timeout.
+template <class T, class Rep, class Period>
+timeout_result<T> with_timeout(std::future<T>& future, std::chrono::duration<Rep, Period> timeout)
+{
+    if (future.wait_for(timeout) != std::future_status::ready)
+    {
+        return {};
+    }
+    if constexpr (std::is_void_v<T>)
+    {
+        future.get();
+        return true;
+    }
+    else
+    {
+        return future.get();
+    }
+}
+
+namespace detail
+{
+// Rate meter after the generic cell rate algorithm: instead of a token count
+// that something has to refill, one atomic word holds the theoretical
+// arrival time, the instant by which every token handed out so far has been
+// paid for at one per `interval`. The refill is thereby computed from the
+// elapsed time on each admission, and an idle meter costs nothing.
+class rate_meter
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    rate_meter(clock::duration per_token, std::uint64_t burst) noexcept
+        : interval(std::max<clock::rep>(per_token.count(), 1)), tolerance(interval * static_cast<clock::rep>(std::max<std::uint64_t>(burst, 1))) {}
+
+    // Takes `tokens` and returns when they are available, or nothing if that
+    // is more than `max_wait` after `now`; then nothing is taken.
+    std::optional<clock::time_point> admit(clock::time_point now, std::uint64_t tokens, clock::duration max_wait) noexcept
+    {
+        const auto at = now.time_since_epoch().count();
+        const auto cost = interval * static_cast<clock::rep>(tokens);
+        auto arrival = theoretical_arrival.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            auto next = std::max(arrival, at) + cost;
+            auto ready = std::max(next - tolerance, at);
+            if (ready - at > max_wait.count())
+            {
+                return std::nullopt;
+            }
+            if (theoretical_arrival.compare_exchange_weak(arrival, next, std::memory_order_relaxed))
+            {
+                return clock::time_point(clock::duration(ready));
+            }
+        }
+    }
+    std::uint64_t available(clock::time_point now) const noexcept
+    {
+        const auto at = now.time_since_epoch().count();
+        auto owed = std::max(theoretical_arrival.load(std::memory_order_relaxed), at) - at;
+        return owed >= tolerance ? 0 : static_cast<std::uint64_t>((tolerance - owed) / interval);
+    }
+    clock::duration per_token() const noexcept
+    {
+        return clock::duration(interval);
+    }
+private:
+    std::atomic<clock::rep> theoretical_arrival {0};
+    const clock::rep interval;
+    const clock::rep tolerance;
+};
+
+template <class Rep, class Period>
+std::chrono::steady_clock::duration per_token(std::uint64_t rate, std::chrono::duration<Rep, Period> period) noexcept
+{
+    return std::chrono::ceil<std::chrono::steady_clock::duration>(period) / static_cast<std::chrono::steady_clock::rep>(std::max<std::uint64_t>(rate, 1));
+}
+}
+
+// Token bucket holding up to `burst` tokens that gains `rate` of them every
+// `period`; it starts full. The refill is lazy, so a bucket is a few words
+// and no timer however many tenants there are: timers only wake waiters,
+// one per waiter at the moment its tokens become available. Waiters are
+// served in arrival order, as each reserves its tokens up front; a waiter
+// that gives up does not hand them back.
+class token_bucket
+{
+public:
+    using clock = scheduler::clock;
+
+    template <class Rep, class Period>
+    token_bucket(scheduler& owner, std::uint64_t rate, std::chrono::duration<Rep, Period> period, std::uint64_t burst) noexcept
+        : sched(&owner), meter(detail::per_token(rate, period), burst) {}
+    token_bucket(const token_bucket&) = delete;
+    token_bucket& operator=(const token_bucket&) = delete;
+
+    // Takes `tokens` if the bucket has them now.
+    bool try_acquire(std::uint64_t tokens = 1) noexcept
+    {
+        return meter.admit(sched->now(), tokens, clock::duration::zero()).has_value();
+    }
+    // Takes `tokens`, going into debt if need be, and returns when they are
+    // available. More tokens than the burst are never available at once but
+    // may still be reserved this way.
+    clock::time_point reserve(std::uint64_t tokens = 1) noexcept
+    {
+        return *meter.admit(sched->now(), tokens, clock::duration::max());
+    }
+    // co_await resumes once the tokens are available, right away if they are.
+    sleep_awaiter acquire(std::uint64_t tokens = 1) noexcept
+    {
+        return sleep_until(reserve(tokens), *sched);
+    }
+    // Calls `f` on the scheduler once the tokens are available.
+    template <class Function, class... Args>
+    timer_handle submit(std::uint64_t tokens, Function&& f, Args&&... args)
+    {
+        return sched->post_at(reserve(tokens), std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+    std::uint64_t available() const noexcept
+    {
+        return meter.available(sched->now());
+    }
+private:
+    scheduler* sched;
+    detail::rate_meter meter;
+};
+
+// Leaky bucket that lets `rate` requests through every `period`, evenly
+// spaced and without bursts; up to `queue_limit` more wait their turn and
+// any beyond that are turned away. Like token_bucket it is a few words with
+// timers only for the waiters.
+class leaky_bucket
+{
+public:
+    using clock = scheduler::clock;
+
+    template <class Rep, class Period>
+    leaky_bucket(scheduler& owner, std::uint64_t rate, std::chrono::duration<Rep, Period> period, std::size_t queue_limit) noexcept
+        : sched(&owner), meter(detail::per_token(rate, period), 1), max_wait(meter.per_token() * static_cast<clock::rep>(queue_limit)) {}
+    leaky_bucket(const leaky_bucket&) = delete;
+    leaky_bucket& operator=(const leaky_bucket&) = delete;
+
+    // Lets a request through if it would not have to wait.
+    bool try_acquire() noexcept
+    {
+        return meter.admit(sched->now(), 1, clock::duration::zero()).has_value();
+    }
+    // Queues a request and returns its turn, or nothing if the queue is full.
+    std::optional<clock::time_point> reserve() noexcept
+    {
+        return meter.admit(sched->now(), 1, max_wait);
+    }
+    // Calls `f` on the scheduler at its turn; returns an empty handle if the
+    // queue is full and `f` was dropped.
+    template <class Function, class... Args>
+    timer_handle submit(Function&& f, Args&&... args)
+    {
+        auto turn = reserve();
+        if (!turn)
+        {
+            return {};
+        }
+        return sched->post_at(*turn, std::forward<Function>(f), std::forward<Args>(args)...);
+    }
+private:
+    scheduler* sched;
+    detail::rate_meter meter;
+    const clock::duration max_wait;
+};
+
+// Calls `f` on the scheduler once `duration` passed without another trigger().
+// The adapter keeps one pooled node for its lifetime, and a trigger only
+// moves the wanted deadline with one atomic exchange: the wheel entry stays
+// where it is, and when it comes due early the node re-arms itself for the
+// latest deadline. A burst of events thus costs one re-insert per delay
+// instead of one restart per event. Use one adapter per key.
+template <class Function>
+class debouncer
 {
 public:
-    instance() noexcept : is_running(false), is_single_shot(true) {}
-    instance(const instance&) = delete;
-    instance(instance&& timer) = delete;
-    instance& operator=(const instance&) = delete;
-    instance& operator=(instance&&) = delete;
+    using clock = scheduler::clock;
 
-    template <class Rep, class Period = std::ratio<1>, class Function, class... Args>
-    std::future<std::result_of_t<Function&&(Args&&...)>>
-    start(std::chrono::duration<Rep, Period> duration, Function&& f, Args&&... args)
+    template <class Rep, class Period>
+    debouncer(scheduler& owner, std::chrono::duration<Rep, Period> duration, Function f)
+        : sched(&owner), node(&owner.acquire()), delay(std::chrono::ceil<clock::duration>(duration)), callback(std::move(f)) {}
+    debouncer(const debouncer&) = delete;
+    debouncer& operator=(const debouncer&) = delete;
+    ~debouncer()
+    {
+        sched->cancel(*node);
+        scheduler::wait_idle(*node);
+        sched->release(*node);
+    }
+
+    void trigger() noexcept
+    {
+        auto deadline = sched->now() + delay;
+        if (due.exchange(deadline.time_since_epoch().count()) == idle)
+        {
+            // The last call may still be returning from its handler.
+            scheduler::wait_idle(*node);
+            sched->arm(*node, deadline, [this](detail::timer_event event)
+            {
+                return expired(event);
+            });
+        }
+    }
+    // Drops the pending call, if any; the node stays armed until the old
+    // deadline and then goes idle.
+    bool cancel() noexcept
     {
-        bool expected;
-        if (!is_running.compare_exchange_strong(expected = false, true))
+        auto current = due.load();
+        while (current != idle && current != parked)
         {
-            if constexpr (DEBUG_MODE)
+            if (due.compare_exchange_weak(current, parked))
             {
-                std::cout << "timer is already running, will stop and restart.\n";
+                return true;
             }
-            is_running.store(false);
-            finished_waiting_for_stop = false;
-            std::unique_lock<std::mutex> lock(running_cond_mutex);
-            running_cond.wait(lock, [this]
+        }
+        return false;
+    }
+    bool pending() const noexcept
+    {
+        auto current = due.load();
+        return current != idle && current != parked;
+    }
+private:
+    // Besides a deadline, `due` holds idle while the node is, and parked
+    // while it is armed with nothing to call.
+    static constexpr clock::rep idle {0};
+    static constexpr clock::rep parked {std::numeric_limits<clock::rep>::min()};
+
+    std::optional<clock::time_point> expired(detail::timer_event event)
+    {
+        if (event == detail::timer_event::cancelled)
+        {
+            due.store(idle);
+            return std::nullopt;
+        }
+        auto current = due.load();
+        for (;;)
+        {
+            if (current != parked)
             {
-                return finished_waiting_for_stop;
-            });
-            if constexpr (DEBUG_MODE)
+                auto deadline = clock::time_point(clock::duration(current));
+                if (deadline > sched->now())
+                {
+                    return deadline;
+                }
+                // Triggers during the call see a deadline and leave the node
+                // to this handler, which then picks theirs up.
+                std::invoke(callback);
+            }
+            if (due.compare_exchange_strong(current, idle))
             {
-                std::cout << "about to (re)start timer.\n";
+                return std::nullopt;
             }
-            is_running.store(true);
         }
-        finished_waiting_for_clock = false;
-        return std::async(std::launch::async, [this, duration, f = std::forward<Function>(f), ...args = std::forward<Args>(args...)]
+    }
+
+    scheduler* sched;
+    detail::timer_node* node;
+    const clock::duration delay;
+    Function callback;
+    std::atomic<clock::rep> due {idle};
+};
+
+// Calls `f` on the scheduler right after the first trigger() and then at
+// most once per `duration`: triggers within an interval fold into one call
+// at its end. Like debouncer it keeps one pooled node, and a trigger inside
+// an interval is a single atomic store.
+template <class Function>
+class throttler
+{
+public:
+    using clock = scheduler::clock;
+
+    template <class Rep, class Period>
+    throttler(scheduler& owner, std::chrono::duration<Rep, Period> duration, Function f)
+        : sched(&owner), node(&owner.acquire()), interval(std::chrono::ceil<clock::duration>(duration)), callback(std::move(f)) {}
+    throttler(const throttler&) = delete;
+    throttler& operator=(const throttler&) = delete;
+    ~throttler()
+    {
+        sched->cancel(*node);
+        scheduler::wait_idle(*node);
+        sched->release(*node);
+    }
+
+    void trigger() noexcept
+    {
+        // Pairs with expired(): either it sees the request, or this sees the
+        // node disarmed and arms it.
+        requested.store(true);
+        if (!armed.load() && !armed.exchange(true))
+        {
+            scheduler::wait_idle(*node);
+            sched->arm(*node, sched->now(), [this](detail::timer_event event)
+            {
+                return expired(event);
+            });
+        }
+    }
+    // Drops the call the triggers so far asked for.
+    bool cancel() noexcept
+    {
+        return requested.exchange(false);
+    }
+    bool pending() const noexcept
+    {
+        return requested.load();
+    }
+private:
+    std::optional<clock::time_point> expired(detail::timer_event event)
+    {
+        if (event == detail::timer_event::cancelled)
+        {
+            armed.store(false);
+            return std::nullopt;
+        }
+        if (requested.exchange(false))
+        {
+            std::invoke(callback);
+            return sched->now() + interval;
+        }
+        // A quiet interval ends the run of calls.
+        armed.store(false);
+        if (requested.load() && !armed.exchange(true))
+        {
+            return sched->now();
+        }
+        return std::nullopt;
+    }
+
+    scheduler* sched;
+    detail::timer_node* node;
+    const clock::duration interval;
+    Function callback;
+    std::atomic_bool requested {false};
+    std::atomic_bool armed {false};
+};
+
+// Drives a wait_backend::external scheduler from an asio or Boost.Asio loop
+// through one steady_timer, so that callbacks run inline on the threads
+// that run the loop instead of being handed over from a dispatcher. Timer
+// is asio::steady_timer or boost::asio::steady_timer, built from
+// `executor`; use a strand if several threads run the loop. Destroy the
+// driver before the loop's context and the scheduler, and not while other
+// threads arm timers.
+template <class Timer>
+class asio_driver
+{
+public:
+    template <class Executor>
+    asio_driver(scheduler& timers, Executor&& executor) : state(std::make_shared<shared>(timers, std::forward<Executor>(executor)))
+    {
+        timers.set_wakeup([weak = std::weak_ptr<shared>(state)]
         {
-            if constexpr (DEBUG_MODE)
+            if (auto alive = weak.lock())
             {
-                std::cout << "thread id this timer runs on= " << std::this_thread::get_id() << "\n";
+                request(alive);
             }
-            std::result_of_t<Function&&(Args&&...)> last_return_of_callable;
-            while (is_running.load())
+        });
+        request(state);
+    }
+    asio_driver(const asio_driver&) = delete;
+    asio_driver& operator=(const asio_driver&) = delete;
+    ~asio_driver()
+    {
+        state->sched.set_wakeup(nullptr);
+        post(state->timer.get_executor(), [alive = state]
+        {
+            alive->stopped = true;
+            ++alive->waits;
+            alive->timer.cancel();
+        });
+    }
+private:
+    // Outlives the driver in the handlers still queued on the loop. All but
+    // `requested` belongs to the loop.
+    struct shared
+    {
+        template <class Executor>
+        shared(scheduler& timers, Executor&& executor) : sched(timers), timer(std::forward<Executor>(executor)) {}
+
+        scheduler& sched;
+        Timer timer;
+        std::atomic_bool requested {false};
+        bool stopped {false};
+        std::uint64_t waits {0};
+        std::optional<scheduler::clock::time_point> armed_for;
+    };
+
+    // Has the loop reprogram the timer, posting at most once until it did.
+    static void request(const std::shared_ptr<shared>& self)
+    {
+        if (!self->requested.exchange(true))
+        {
+            post(self->timer.get_executor(), [self]
             {
-                clock(duration);
-                {
-                    std::unique_lock<std::mutex> lock(wait_cond_mutex);
-                    wait_cond.wait(lock, [this]
-                    {
-                        return finished_waiting_for_clock;
-                    });
-                }
-                if (!is_running.load())
-                {
-                    if constexpr (DEBUG_MODE)
-                    {
-                        std::cout << "async_timer was stopped prematurely.\n";
-                    }
-                    break;
-                }
-                last_return_of_callable = std::invoke(f, std::forward<Args>(args)...);
-                if (is_single_shot.load())
-                {
-                    if constexpr (DEBUG_MODE)
-                    {
-                        std::cout << "stop timer due to activated single shot property.\n";
-                    }
-                    break;
-                }
+                reprogram(self);
+            });
+        }
+    }
+    static void reprogram(const std::shared_ptr<shared>& self)
+    {
+        self->requested.store(false);
+        if (self->stopped)
+        {
+            return;
+        }
+        auto next = self->sched.next_deadline();
+        if (next == self->armed_for)
+        {
+            return;
+        }
+        // Moving the expiry aborts the wait in flight, whose handler then
+        // sees a newer generation and leaves the timer alone.
+        self->armed_for = next;
+        auto generation = ++self->waits;
+        if (!next)
+        {
+            self->timer.cancel();
+            return;
+        }
+        self->timer.expires_at(*next);
+        self->timer.async_wait([self, generation](const auto&)
+        {
+            if (generation != self->waits)
+            {
+                return;
             }
-            std::lock_guard<std::mutex> lk(running_cond_mutex);
-            finished_waiting_for_stop = true;
-            running_cond.notify_one();
-            is_running.store(false);
-            return last_return_of_callable;
+            self->armed_for.reset();
+            self->sched.advance(self->sched.now());
+            reprogram(self);
         });
     }
-    void stop() noexcept
+
+    std::shared_ptr<shared> state;
+};
+
+#if defined(ASYNC_TIMERS_HAS_IO_URING)
+// Drives a wait_backend::external scheduler from an io_uring that the owner
+// sets up, submits and reaps, with or without liburing: the driver only
+// fills SQEs and handles its own CQEs, so callbacks run inline on the
+// ring's thread. It keeps one absolute IORING_OP_TIMEOUT on the next
+// deadline, moved with IORING_TIMEOUT_UPDATE (Linux 5.11) when an arm needs
+// it earlier, and a read on an eventfd that arms signal. Its CQEs carry the
+// user_data `first` to `first + 2`. The SQEs point into the driver, so it has
+// to outlive them.
+class io_uring_driver
+{
+public:
+    explicit io_uring_driver(scheduler& timers, std::uint64_t first = 0) : sched(timers), base(first), event_fd(::eventfd(0, EFD_CLOEXEC))
     {
-        is_running.store(false);
+        if (event_fd < 0)
+        {
+            throw std::system_error(errno, std::system_category(), "async_timers::io_uring_driver eventfd");
+        }
+        sched.set_wakeup([fd = event_fd]
+        {
+            std::uint64_t one {1};
+            [[maybe_unused]] auto written = ::write(fd, &one, sizeof(one));
+        });
     }
-    void set_single_shot()
+    io_uring_driver(const io_uring_driver&) = delete;
+    io_uring_driver& operator=(const io_uring_driver&) = delete;
+    ~io_uring_driver()
     {
-        is_single_shot.store(true);
+        sched.set_wakeup(nullptr);
+        ::close(event_fd);
+    }
+
+    // Queues the driver's first SQEs. get_sqe() returns a free
+    // io_uring_sqe*, as io_uring_get_sqe() does.
+    template <class GetSqe>
+    void start(GetSqe&& get_sqe)
+    {
+        read_wakeup(get_sqe);
+        reprogram(get_sqe);
     }
-    void set_periodic()
+    // Returns false for a CQE that is not the driver's. For one that is, runs
+    // the due timers and queues the SQEs that follow.
+    template <class GetSqe>
+    bool handle(const io_uring_cqe& cqe, GetSqe&& get_sqe)
     {
-        is_single_shot.store(false);
+        if (cqe.user_data < base || cqe.user_data - base > wakeup_op)
+        {
+            return false;
+        }
+        switch (cqe.user_data - base)
+        {
+        case timeout_op:
+            timeout_pending = false;
+            break;
+        case wakeup_op:
+            read_wakeup(get_sqe);
+            break;
+        default:
+            break;
+        }
+        sched.advance(sched.now());
+        reprogram(get_sqe);
+        return true;
     }
 private:
-    template <class Rep, class Period = std::ratio<1>>
-    void clock(std::chrono::duration<Rep, Period> duration)
+    enum : std::uint64_t
+    {
+        timeout_op,
+        update_op,
+        wakeup_op
+    };
+
+    template <class GetSqe>
+    static io_uring_sqe& next_sqe(GetSqe& get_sqe)
     {
-        if constexpr (DEBUG_MODE)
+        io_uring_sqe* sqe = get_sqe();
+        if (sqe == nullptr)
         {
-            std::cout << "start clock that counts down to 0.\n";
+            throw std::system_error(std::make_error_code(std::errc::resource_unavailable_try_again), "async_timers::io_uring_driver submission queue");
         }
-        std::unique_lock<std::mutex> lock(wait_cond_mutex);
-        auto now = std::chrono::system_clock::now();
-        wait_cond.wait_until(lock, now + duration, [this]
+        *sqe = {};
+        return *sqe;
+    }
+    static __kernel_timespec to_timespec(scheduler::clock::time_point at) noexcept
+    {
+        auto since_epoch = std::max(at.time_since_epoch(), scheduler::clock::duration(1));
+        auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+        return {seconds.count(), std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch - seconds).count()};
+    }
+    template <class GetSqe>
+    void read_wakeup(GetSqe& get_sqe)
+    {
+        auto& sqe = next_sqe(get_sqe);
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = event_fd;
+        sqe.addr = reinterpret_cast<std::uintptr_t>(&wakeups);
+        sqe.len = sizeof(wakeups);
+        sqe.user_data = base + wakeup_op;
+    }
+    template <class GetSqe>
+    void reprogram(GetSqe& get_sqe)
+    {
+        auto next = sched.next_deadline();
+        if (!next || (timeout_pending && *next >= armed_for))
         {
-            return is_running.load() ? false : true;
-        });
-        finished_waiting_for_clock = true;
-        lock.unlock();
-        wait_cond.notify_one();
+            return;
+        }
+        auto& sqe = next_sqe(get_sqe);
+        sqe.fd = -1;
+        sqe.timeout_flags = IORING_TIMEOUT_ABS;
+        if (timeout_pending)
+        {
+            update_at = to_timespec(*next);
+            sqe.opcode = IORING_OP_TIMEOUT_REMOVE;
+            sqe.addr = base + timeout_op;
+            sqe.addr2 = reinterpret_cast<std::uintptr_t>(&update_at);
+            sqe.timeout_flags |= IORING_TIMEOUT_UPDATE;
+            sqe.user_data = base + update_op;
+        }
+        else
+        {
+            timeout_at = to_timespec(*next);
+            sqe.opcode = IORING_OP_TIMEOUT;
+            sqe.addr = reinterpret_cast<std::uintptr_t>(&timeout_at);
+            sqe.len = 1;
+            sqe.user_data = base + timeout_op;
+            timeout_pending = true;
+        }
+        armed_for = *next;
+    }
+
+    scheduler& sched;
+    const std::uint64_t base;
+    const int event_fd;
+    std::uint64_t wakeups {0};
+    __kernel_timespec timeout_at {};
+    __kernel_timespec update_at {};
+    bool timeout_pending {false};
+    scheduler::clock::time_point armed_for {};
+};
+#endif
+
+class local_timer;
+
+// Timer queue owned by a single thread, typically an event loop: no locks
+// and no atomics. The owner sleeps until next_deadline() and then calls
+// run_expired(). Timers sit in an intrusive 4-ary min-heap on their deadline.
+class local_timer_queue
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    local_timer_queue() = default;
+    local_timer_queue(const local_timer_queue&) = delete;
+    local_timer_queue& operator=(const local_timer_queue&) = delete;
+    ~local_timer_queue();
+
+    std::optional<clock::time_point> next_deadline() const noexcept;
+    // Runs every timer due by `now`, earliest first, and returns how many
+    // ran. Timers armed by the callbacks for `now` or earlier run as well.
+    std::size_t run_expired(clock::time_point now = clock::now());
+    bool empty() const noexcept
+    {
+        return heap.empty();
+    }
+    std::size_t size() const noexcept
+    {
+        return heap.size();
+    }
+private:
+    friend class local_timer;
+
+    static constexpr std::size_t arity {4};
+    static constexpr std::size_t npos {std::numeric_limits<std::size_t>::max()};
+
+    void push(local_timer& timer);
+    void erase(local_timer& timer) noexcept;
+    void sift_up(std::size_t index) noexcept;
+    void sift_down(std::size_t index) noexcept;
+    void place(local_timer& timer, std::size_t index) noexcept;
+
+    std::vector<local_timer*> heap;
+    // Timer whose callback is running, cleared if it is destroyed meanwhile.
+    local_timer* running {nullptr};
+};
+
+// Single-thread counterpart of instance, bound to a local_timer_queue that
+// it must not outlive and only to be used from the queue's thread. Callbacks
+// run inside run_expired() and their results are discarded, so there is no
+// future.
+class local_timer
+{
+public:
+    using clock = local_timer_queue::clock;
+
+    explicit local_timer(local_timer_queue& owner) noexcept : queue(&owner) {}
+    local_timer(const local_timer&) = delete;
+    local_timer& operator=(const local_timer&) = delete;
+    ~local_timer()
+    {
+        stop();
+        if (queue->running == this)
+        {
+            queue->running = nullptr;
+        }
+    }
+
+    // Replaces any pending arm.
+    template <class Rep, class Period = std::ratio<1>, class Function, class... Args>
+    void start(std::chrono::duration<Rep, Period> duration, Function&& f, Args&&... args)
+    {
+        stop();
+        callback = [f = std::forward<Function>(f), ...args = std::forward<Args>(args)]() mutable
+        {
+            std::invoke(f, args...);
+        };
+        ticks = detail::cadence(clock::now(), std::chrono::ceil<clock::duration>(duration));
+        deadline = ticks.deadline();
+        queue->push(*this);
+    }
+    void stop() noexcept
+    {
+        if (slot != local_timer_queue::npos)
+        {
+            queue->erase(*this);
+        }
+        stopped = true;
+    }
+    void set_single_shot() noexcept
+    {
+        is_single_shot = true;
+    }
+    void set_periodic(catch_up policy = catch_up::skip) noexcept
+    {
+        missed_ticks = policy;
+        is_single_shot = false;
+    }
+    bool armed() const noexcept
+    {
+        return slot != local_timer_queue::npos;
     }
 private:
-    std::atomic_bool is_running, is_single_shot;
-    std::condition_variable wait_cond, running_cond;
-    std::mutex wait_cond_mutex, running_cond_mutex;
-    bool finished_waiting_for_clock, finished_waiting_for_stop;
+    friend class local_timer_queue;
+
+    local_timer_queue* queue;
+    std::size_t slot {local_timer_queue::npos};
+    clock::time_point deadline {};
+    detail::cadence ticks {clock::time_point(), clock::duration(1)};
+    inplace_function<void(), detail::handler_capacity> callback;
+    bool is_single_shot {true};
+    // Set by stop(), so a callback that stops its own periodic timer is not
+    // re-armed afterwards.
+    bool stopped {true};
+    catch_up missed_ticks {catch_up::skip};
 };
 
+inline local_timer_queue::~local_timer_queue()
+{
+    while (!heap.empty())
+    {
+        heap.back()->stop();
+    }
+}
+
+inline std::optional<local_timer_queue::clock::time_point> local_timer_queue::next_deadline() const noexcept
+{
+    if (heap.empty())
+    {
+        return std::nullopt;
+    }
+    return heap.front()->deadline;
+}
+
+inline std::size_t local_timer_queue::run_expired(clock::time_point now)
+{
+    std::size_t count {0};
+    while (!heap.empty() && heap.front()->deadline <= now)
+    {
+        auto& timer = *heap.front();
+        erase(timer);
+        timer.stopped = false;
+        // Moved out so the callback may re-start its own timer.
+        auto callback = std::move(timer.callback);
+        running = &timer;
+        try
+        {
+            callback();
+        }
+        catch (...)
+        {
+            running = nullptr;
+            throw;
+        }
+        ++count;
+        if (running == nullptr)
+        {
+            continue;
+        }
+        running = nullptr;
+        if (!timer.is_single_shot && !timer.stopped && !timer.armed())
+        {
+            timer.callback = std::move(callback);
+            timer.deadline = timer.ticks.advance(now, timer.missed_ticks);
+            push(timer);
+        }
+    }
+    return count;
+}
+
+inline void local_timer_queue::push(local_timer& timer)
+{
+    heap.push_back(&timer);
+    timer.stopped = false;
+    place(timer, heap.size() - 1);
+    sift_up(timer.slot);
+}
+
+inline void local_timer_queue::erase(local_timer& timer) noexcept
+{
+    auto index = timer.slot;
+    timer.slot = npos;
+    auto last = heap.back();
+    heap.pop_back();
+    if (last == &timer)
+    {
+        return;
+    }
+    place(*last, index);
+    sift_up(index);
+    sift_down(last->slot);
+}
+
+inline void local_timer_queue::sift_up(std::size_t index) noexcept
+{
+    auto timer = heap[index];
+    while (index > 0)
+    {
+        auto parent = (index - 1) / arity;
+        if (heap[parent]->deadline <= timer->deadline)
+        {
+            break;
+        }
+        place(*heap[parent], index);
+        index = parent;
+    }
+    place(*timer, index);
+}
+
+inline void local_timer_queue::sift_down(std::size_t index) noexcept
+{
+    auto timer = heap[index];
+    for (;;)
+    {
+        auto first = index * arity + 1;
+        if (first >= heap.size())
+        {
+            break;
+        }
+        auto earliest = first;
+        for (auto child = first + 1; child < std::min(first + arity, heap.size()); ++child)
+        {
+            if (heap[child]->deadline < heap[earliest]->deadline)
+            {
+                earliest = child;
+            }
+        }
+        if (timer->deadline <= heap[earliest]->deadline)
+        {
+            break;
+        }
+        place(*heap[earliest], index);
+        index = earliest;
+    }
+    place(*timer, index);
+}
+
+inline void local_timer_queue::place(local_timer& timer, std::size_t index) noexcept
+{
+    heap[index] = &timer;
+    timer.slot = index;
+}
+
 }
 
 #endif /* ASYNC_TIMERS_H */
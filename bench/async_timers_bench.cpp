@@ -0,0 +1,412 @@
+#include "async_timers.hpp"
+
+#include <benchmark/benchmark.h>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+using namespace std::chrono_literals;
+
+namespace
+{
+using bench_clock = std::chrono::steady_clock;
+
+async_timers::scheduler& shared_scheduler()
+{
+    static async_timers::scheduler shared;
+    return shared;
+}
+
+void noop() noexcept {}
+
+// instance callbacks need a non-void result.
+int nothing() noexcept
+{
+    return 0;
+}
+
+double to_us(bench_clock::duration d)
+{
+    return std::chrono::duration<double, std::micro>(d).count();
+}
+
+void report_percentiles(benchmark::State& state, std::vector<bench_clock::duration>& samples)
+{
+    if (samples.empty())
+    {
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto at = [&samples](double q)
+    {
+        return to_us(samples[std::min(samples.size() - 1, static_cast<std::size_t>(q * samples.size()))]);
+    };
+    state.counters["p50_us"] = at(0.50);
+    state.counters["p99_us"] = at(0.99);
+    state.counters["p999_us"] = at(0.999);
+    state.counters["max_us"] = to_us(samples.back());
+}
+
+std::size_t heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#else
+    return 0;
+#endif
+}
+
+// Arm/cancel throughput --------------------------------------------------
+
+void scheduler_arm_cancel(benchmark::State& state)
+{
+    async_timers::instance timer(shared_scheduler());
+    for (auto _ : state)
+    {
+        timer.start_detached(1h, nothing);
+        timer.stop();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(scheduler_arm_cancel)->Threads(1)->Threads(8)->Threads(64)->UseRealTime();
+
+void scheduler_rearm(benchmark::State& state)
+{
+    async_timers::instance timer(shared_scheduler());
+    for (auto _ : state)
+    {
+        timer.start_detached(1h, nothing);
+    }
+    timer.stop();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(scheduler_rearm)->Threads(1)->Threads(8)->Threads(64)->UseRealTime();
+
+void scheduler_post_cancel(benchmark::State& state)
+{
+    auto& shared = shared_scheduler();
+    for (auto _ : state)
+    {
+        auto handle = shared.post_after(1h, noop);
+        benchmark::DoNotOptimize(handle.cancel());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(scheduler_post_cancel)->Threads(1)->Threads(8)->Threads(64)->UseRealTime();
+
+void scheduler_arm_cancel_bulk(benchmark::State& state)
+{
+    auto& shared = shared_scheduler();
+    std::vector<async_timers::timer_spec> specs(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        auto deadline = shared.now() + 1h;
+        for (std::size_t i = 0; i < specs.size(); ++i)
+        {
+            specs[i].deadline = deadline + std::chrono::microseconds((i * 7919) % 30000);
+            specs[i].callback = noop;
+        }
+        auto handles = shared.arm_bulk(specs);
+        benchmark::DoNotOptimize(shared.cancel_bulk(handles));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(scheduler_arm_cancel_bulk)->Arg(1000)->Arg(50000)->UseRealTime();
+
+// Restores a snapshot of `range` tagged timers into a fresh scheduler, as
+// after a restart.
+void scheduler_restore_snapshot(benchmark::State& state)
+{
+    async_timers::timer_registry registry;
+    registry.bind(0, [](std::uint64_t) {});
+    std::vector<async_timers::timer_snapshot_entry> entries;
+    {
+        async_timers::scheduler source;
+        auto deadline = source.now() + 1h;
+        for (std::int64_t i = 0; i < state.range(0); ++i)
+        {
+            source.post_tagged(deadline + std::chrono::microseconds(i), registry, 0, static_cast<std::uint64_t>(i));
+        }
+        entries = source.snapshot();
+    }
+    for (auto _ : state)
+    {
+        async_timers::scheduler sched;
+        benchmark::DoNotOptimize(sched.restore(entries, registry));
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(scheduler_restore_snapshot)->Arg(100000)->Arg(1000000)->Iterations(3)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void sharded_post_cancel(benchmark::State& state)
+{
+    static async_timers::sharded_scheduler shared;
+    for (auto _ : state)
+    {
+        auto handle = shared.post_after(1h, noop);
+        benchmark::DoNotOptimize(handle.cancel());
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["shards"] = benchmark::Counter(static_cast<double>(shared.size()), benchmark::Counter::kAvgThreads);
+}
+BENCHMARK(sharded_post_cancel)->Threads(1)->Threads(8)->Threads(64)->UseRealTime();
+
+void local_arm_cancel(benchmark::State& state)
+{
+    async_timers::local_timer_queue queue;
+    async_timers::local_timer timer(queue);
+    for (auto _ : state)
+    {
+        timer.start(1h, noop);
+        timer.stop();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(local_arm_cancel);
+
+// Every start() of a legacy instance spawns a thread, so keep the thread
+// counts low.
+void legacy_arm_cancel(benchmark::State& state)
+{
+    async_timers::instance timer;
+    for (auto _ : state)
+    {
+        timer.start_detached(1h, nothing);
+        timer.stop();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(legacy_arm_cancel)->Threads(1)->Threads(8)->UseRealTime();
+
+// Rate limiting and debouncing --------------------------------------------
+
+void token_bucket_try_acquire(benchmark::State& state)
+{
+    static async_timers::token_bucket bucket(shared_scheduler(), 1, 1h, 1);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(bucket.try_acquire());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(token_bucket_try_acquire)->Threads(1)->Threads(8)->UseRealTime();
+
+// Compare with scheduler_rearm, which restarts an instance on every event.
+void debouncer_trigger(benchmark::State& state)
+{
+    static async_timers::debouncer debounce(shared_scheduler(), 1h, noop);
+    for (auto _ : state)
+    {
+        debounce.trigger();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(debouncer_trigger)->Threads(1)->Threads(8)->UseRealTime();
+
+// Clock reads ---------------------------------------------------------------
+
+template <class Clock>
+void clock_now(benchmark::State& state)
+{
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(Clock::now());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(clock_now, std::chrono::steady_clock);
+BENCHMARK_TEMPLATE(clock_now, async_timers::tsc_clock);
+
+void scheduler_coarse_now(benchmark::State& state)
+{
+    auto& shared = shared_scheduler();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(shared.coarse_now());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(scheduler_coarse_now);
+
+void scheduler_metrics_snapshot(benchmark::State& state)
+{
+    auto& shared = shared_scheduler();
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(shared.metrics());
+    }
+}
+BENCHMARK(scheduler_metrics_snapshot);
+
+// Fire latency against the number of active timers -----------------------
+
+void scheduler_fire_latency(benchmark::State& state)
+{
+    constexpr std::size_t burst {50};
+    async_timers::scheduler sched;
+    for (std::int64_t i = 0; i < state.range(0); ++i)
+    {
+        sched.post_after(1h + std::chrono::microseconds(i), noop);
+    }
+    // Measure with all of them in the wheel, not still draining from the arm
+    // queues: each marker timer makes the dispatcher drain what is queued.
+    while (sched.metrics().wheel_entries < static_cast<std::uint64_t>(state.range(0)))
+    {
+        std::atomic<bool> drained {false};
+        sched.post_after(1ms, [&drained]
+        {
+            drained.store(true);
+            drained.notify_one();
+        });
+        drained.wait(false);
+    }
+    std::vector<bench_clock::duration> samples;
+    std::array<bench_clock::duration, burst> lateness {};
+    std::atomic<std::size_t> fired {0};
+    for (auto _ : state)
+    {
+        fired.store(0);
+        auto start = bench_clock::now() + 1ms;
+        for (std::size_t i = 0; i < burst; ++i)
+        {
+            auto deadline = start + std::chrono::microseconds(20 * i);
+            sched.post_at(deadline, [&lateness, &fired, deadline, i]
+            {
+                lateness[i] = bench_clock::now() - deadline;
+                fired.fetch_add(1);
+                fired.notify_one();
+            });
+        }
+        for (auto seen = fired.load(); seen != burst; seen = fired.load())
+        {
+            fired.wait(seen);
+        }
+        samples.insert(samples.end(), lateness.begin(), lateness.end());
+    }
+    report_percentiles(state, samples);
+    state.counters["active_timers"] = static_cast<double>(state.range(0));
+}
+BENCHMARK(scheduler_fire_latency)->Arg(1)->Arg(1000)->Arg(100000)->Arg(1000000)->Iterations(40)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void legacy_fire_latency(benchmark::State& state)
+{
+    std::vector<std::unique_ptr<async_timers::instance>> active;
+    for (std::int64_t i = 0; i < state.range(0); ++i)
+    {
+        active.push_back(std::make_unique<async_timers::instance>());
+        active.back()->start_detached(1h, nothing);
+    }
+    std::vector<bench_clock::duration> samples;
+    async_timers::instance timer;
+    for (auto _ : state)
+    {
+        auto deadline = bench_clock::now() + 1ms;
+        auto lateness = timer.start(1ms, [deadline]
+        {
+            return bench_clock::now() - deadline;
+        });
+        samples.push_back(lateness.get());
+    }
+    for (auto& t : active)
+    {
+        t->stop();
+    }
+    report_percentiles(state, samples);
+    state.counters["active_timers"] = static_cast<double>(state.range(0));
+}
+BENCHMARK(legacy_fire_latency)->Arg(1)->Arg(64)->Arg(1024)->Iterations(500)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Periodic drift ---------------------------------------------------------
+
+template <class Timer>
+void periodic_drift(benchmark::State& state, Timer& timer)
+{
+    constexpr auto period = 1ms;
+    const auto ticks = static_cast<std::size_t>(state.range(0));
+    std::vector<bench_clock::time_point> fires(ticks);
+    for (auto _ : state)
+    {
+        std::atomic<std::size_t> count {0};
+        auto origin = bench_clock::now();
+        timer.set_periodic();
+        timer.start_detached(period, [&fires, &count, ticks]
+        {
+            auto n = count.load(std::memory_order_relaxed);
+            if (n < ticks)
+            {
+                fires[n] = bench_clock::now();
+                count.store(n + 1);
+                count.notify_one();
+            }
+            return n;
+        });
+        for (auto seen = count.load(); seen < ticks; seen = count.load())
+        {
+            count.wait(seen);
+        }
+        timer.stop();
+        std::vector<bench_clock::duration> lateness;
+        lateness.reserve(ticks);
+        for (std::size_t k = 0; k < ticks; ++k)
+        {
+            lateness.push_back(fires[k] - (origin + period * (k + 1)));
+        }
+        state.counters["drift_us"] = to_us(lateness.back());
+        report_percentiles(state, lateness);
+    }
+}
+
+void scheduler_periodic_drift(benchmark::State& state)
+{
+    async_timers::instance timer(shared_scheduler());
+    periodic_drift(state, timer);
+}
+BENCHMARK(scheduler_periodic_drift)->Arg(1000)->Arg(10000)->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void legacy_periodic_drift(benchmark::State& state)
+{
+    async_timers::instance timer;
+    periodic_drift(state, timer);
+}
+BENCHMARK(legacy_periodic_drift)->Arg(1000)->Arg(10000)->Iterations(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Memory per active timer ------------------------------------------------
+
+void scheduler_memory_per_instance(benchmark::State& state)
+{
+    const auto count = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state)
+    {
+        async_timers::scheduler sched;
+        auto before = heap_in_use();
+        std::vector<std::unique_ptr<async_timers::instance>> timers;
+        timers.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            timers.push_back(std::make_unique<async_timers::instance>(sched));
+            timers.back()->start_detached(1h, nothing);
+        }
+        state.counters["bytes_per_timer"] = static_cast<double>(heap_in_use() - before) / count;
+    }
+}
+BENCHMARK(scheduler_memory_per_instance)->Arg(1000)->Arg(100000)->Arg(1000000)->Iterations(1)->Unit(benchmark::kMillisecond);
+
+void scheduler_memory_per_post(benchmark::State& state)
+{
+    const auto count = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state)
+    {
+        async_timers::scheduler sched;
+        auto before = heap_in_use();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            sched.post_after(1h, noop);
+        }
+        state.counters["bytes_per_timer"] = static_cast<double>(heap_in_use() - before) / count;
+    }
+}
+BENCHMARK(scheduler_memory_per_post)->Arg(1000)->Arg(100000)->Arg(1000000)->Iterations(1)->Unit(benchmark::kMillisecond);
+}
+
+BENCHMARK_MAIN();